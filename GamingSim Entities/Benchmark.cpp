@@ -0,0 +1,549 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <set>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <xmmintrin.h>
+#include "Benchmark.h"
+#include "Verlet.h"
+#include "GameTimer.h"
+
+const float Benchmark::RANGE = 50.0f;
+const float Benchmark::STEP = 1.0f / 60.0f;
+
+#ifdef BENCHMARK_ALLOCATIONS
+//Every allocation goes through here, so the benchmarks can count them. The workers
+//allocate too, so the count is atomic. This is only built into benchmark builds, so
+//the simulation itself does not pay for the count.
+static std::atomic<long long> allocations(0);
+
+void* operator new(size_t size){
+	++allocations;
+
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL) throw std::bad_alloc();
+
+	return p;
+}
+
+void operator delete(void* p) throw(){
+	free(p);
+}
+#endif
+
+//The matrix product the math types used before they used SSE
+static Matrix4 ScalarProduct(const Matrix4& m, const Matrix4& a){
+	Matrix4 out;
+
+	for(unsigned int r = 0; r < 4; ++r) {
+		for(unsigned int c = 0; c < 4; ++c) {
+			out.values[c + (r*4)] = 0.0f;
+			for(unsigned int i = 0; i < 4; ++i) {
+				out.values[c + (r*4)] += m.values[c+(i*4)] * a.values[(r*4)+i];
+			}
+		}
+	}
+
+	return out;
+}
+
+//The point transform the math types used before they used SSE
+static Vector3 ScalarTransform(const Matrix4& m, const Vector3& v){
+	float x = v.x*m.values[0] + v.y*m.values[4] + v.z*m.values[8]  + m.values[12];
+	float y = v.x*m.values[1] + v.y*m.values[5] + v.z*m.values[9]  + m.values[13];
+	float z = v.x*m.values[2] + v.y*m.values[6] + v.z*m.values[10] + m.values[14];
+	float w = v.x*m.values[3] + v.y*m.values[7] + v.z*m.values[11] + m.values[15];
+
+	return Vector3(x/w, y/w, z/w);
+}
+
+//The squared distance the math types used before they stopped calling pow
+static float PowDistanceNSq(const Vector3& a, const Vector3& b){
+	return static_cast<float>(pow((b.x - a.x), 2) + pow((b.y - a.y), 2) + pow(b.z - a.z, 2));
+}
+
+//A Vector3 is 12 bytes, so it is loaded into the low 3 lanes of a register one
+//component at a time, as Vector3 would have to if it used SSE
+static __m128 Load(const Vector3& v){
+	return _mm_set_ps(0.0f, v.z, v.y, v.x);
+}
+
+//The dot product of two loaded vectors, in the lowest lane. The lanes are added in
+//the same order as Vector3 adds them.
+static __m128 SseDot(__m128 a, __m128 b){
+	__m128 m = _mm_mul_ps(a, b);
+	__m128 sum = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_add_ss(sum, _mm_movehl_ps(m, m));
+}
+
+//The dot product and magnitude of Vector3, done with SSE
+static float SseDotProduct(const Vector3& a, const Vector3& b){
+	return _mm_cvtss_f32(SseDot(Load(a), Load(b)));
+}
+
+static float SseMagnitude(const Vector3& v){
+	__m128 l = Load(v);
+	return _mm_cvtss_f32(_mm_sqrt_ss(SseDot(l, l)));
+}
+
+//The normalise the math types used before they used SSE
+static Vector3 ScalarNormalised(const Vector3& v){
+	float magnitude = v.GetMagnitude();
+	return Vector3(v.x / magnitude, v.y / magnitude, v.z / magnitude);
+}
+
+bool Benchmark::CountsAllocations(){
+#ifdef BENCHMARK_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+long long Benchmark::GetAllocations(){
+#ifdef BENCHMARK_ALLOCATIONS
+	return allocations;
+#else
+	return 0;
+#endif
+}
+
+void Benchmark::PrintAllocations(const char* what, long long made, int count){
+	if (CountsAllocations()){
+		printf("  %.1f allocations per %s\n", static_cast<double>(made) / count, what);
+	} else {
+		printf("  Allocations are only counted when built with BENCHMARK_ALLOCATIONS\n");
+	}
+}
+
+int Benchmark::Run(int argc, char** argv){
+	if (argc > 0 && strcmp(argv[0], "allocations") == 0){
+		return Allocations(argc - 1, argv + 1);
+	}
+
+	if (argc > 0 && strcmp(argv[0], "pairs") == 0){
+		return Pairs(argc - 1, argv + 1);
+	}
+
+	if (argc > 0 && strcmp(argv[0], "scaling") == 0){
+		return Scaling(argc - 1, argv + 1);
+	}
+
+	if (argc > 0 && strcmp(argv[0], "maths") == 0){
+		return Maths(argc - 1, argv + 1);
+	}
+
+	if (argc > 0 && strcmp(argv[0], "sleep") == 0){
+		return Sleep(argc - 1, argv + 1);
+	}
+
+	printf("Benchmarks:\n");
+	printf("  allocations [spheres = 200] [maxDepth = 3] [steps = 300]\n");
+	printf("  pairs [pairs = 10000] [runs = 200]\n");
+	printf("  scaling [spheres = 100000] [maxThreads = hardware threads] [steps = 10]\n");
+	printf("  maths [items = 100000] [runs = 5]\n");
+	printf("  sleep [spheres = 64] [steps = 1800]\n");
+
+	return 1;
+}
+
+int Benchmark::Argument(int argc, char** argv, int index, int fallback){
+	return index < argc ? atoi(argv[index]) : fallback;
+}
+
+void Benchmark::FillScene(Verlet& v, int spheres, float range, bool moving, vector<Sphere*>& created){
+	srand(1);
+
+	for (int i=0; i<spheres; ++i){
+		//Each random number is drawn in its own statement, as the order function
+		//arguments are worked out in differs between compilers
+		float x = ((rand() % 1000) / 1000.0f - 0.5f) * range * 0.9f;
+		float y = ((rand() % 1000) / 1000.0f - 0.5f) * range * 0.9f;
+		float z = ((rand() % 1000) / 1000.0f - 0.5f) * range * 0.9f;
+		float radius = 0.3f + (rand() % 100) / 100.0f;
+		float mass = static_cast<float>(rand() % 40 + 1);
+
+		Sphere* s = v.CreateSphere(Vector3(x, y, z), radius, mass, 0.99999f, 0.3f);
+
+		if (s == NULL) continue;
+		created.push_back(s);
+
+		if (moving){
+			float vx = static_cast<float>(rand() % 3 - 1);
+			float vy = static_cast<float>(rand() % 3 - 1);
+			float vz = static_cast<float>(rand() % 3 - 1);
+
+			s->setVelocity(Vector3(vx, vy, vz), 0.1f);
+		}
+	}
+
+	v.CreatePlane(Vector3(0, 1, 0), range/2, Vector3(range/2, range/2, range/2));
+	v.CreatePlane(Vector3(0, -1, 0), range/2, Vector3(range/2, range/2, range/2));
+	v.CreatePlane(Vector3(1, 0, 0), range/2, Vector3(range/2, range/2, range/2));
+	v.CreatePlane(Vector3(-1, 0, 0), range/2, Vector3(range/2, range/2, range/2));
+	v.CreatePlane(Vector3(0, 0, 1), range/2, Vector3(range/2, range/2, range/2));
+	v.CreatePlane(Vector3(0, 0, -1), range/2, Vector3(range/2, range/2, range/2));
+}
+
+int Benchmark::Allocations(int argc, char** argv){
+	int spheres = Argument(argc, argv, 0, 200);
+	int maxDepth = Argument(argc, argv, 1, 3);
+	int steps = Argument(argc, argv, 2, 300);
+
+	Verlet v(Vector3(RANGE, RANGE, RANGE), 2, maxDepth);
+	vector<Sphere*> created;
+	FillScene(v, spheres, RANGE, true, created);
+
+	//The first step is left out, as it makes the allocations later steps reuse
+	v.update(STEP);
+
+	GameTimer timer;
+	long long before = GetAllocations();
+
+	for (int i=0; i<steps; ++i){
+		v.update(STEP);
+	}
+
+	float time = timer.GetTime();
+	long long made = GetAllocations() - before;
+
+	printf("%d spheres, depth %d, %d steps\n", spheres, maxDepth, steps);
+	PrintAllocations("step", made, steps);
+	printf("  %.3f ms per step\n", time / steps);
+
+	return 0;
+}
+
+int Benchmark::Pairs(int argc, char** argv){
+	int pairs = Argument(argc, argv, 0, 10000);
+	int runs = Argument(argc, argv, 1, 200);
+
+	//Half as many spheres as pairs gives each sphere a handful of contacts
+	Verlet v(Vector3(RANGE, RANGE, RANGE));
+	vector<Sphere*> spheres;
+	FillScene(v, max(pairs / 2, 2), RANGE, false, spheres);
+
+	//Share random pairs out between 4 workers, as a broad phase's leaves would find
+	//them. One in three pairs straddles a leaf border, so is found again by another
+	//worker, from its other sphere.
+	const int WORKERS = 4;
+	PairBuffer buffer;
+	buffer.Reset(WORKERS);
+
+	int found = 0;
+	for (int i=0; i<pairs; ++i){
+		int a = rand() % spheres.size();
+		int b = rand() % spheres.size();
+		if (a == b) continue;
+
+		buffer.Worker(i % WORKERS).push_back(PairBuffer::Ordered(spheres[a], spheres[b]));
+		++found;
+
+		if (rand() % 3 == 0){
+			buffer.Worker((i + 1) % WORKERS).push_back(PairBuffer::Ordered(spheres[b], spheres[a]));
+			++found;
+		}
+	}
+
+	//Keep a copy of each worker's pairs, so every run of both ways starts from the
+	//same lists
+	vector<vector<PairBuffer::SpherePair>> lists(WORKERS);
+	for (int w=0; w<WORKERS; ++w){
+		lists[w] = buffer.Worker(w);
+	}
+
+	//The old way: every pair into a std::set, made afresh each frame
+	GameTimer timer;
+	long long before = GetAllocations();
+	int setSize = 0;
+
+	for (int r=0; r<runs; ++r){
+		std::set<PairBuffer::SpherePair> set;
+
+		for (int w=0; w<WORKERS; ++w){
+			set.insert(lists[w].begin(), lists[w].end());
+		}
+
+		setSize = set.size();
+	}
+
+	float setTime = timer.GetTime();
+	long long setAllocations = GetAllocations() - before;
+
+	//The new way: the same buffer, refilled and merged every frame
+	before = GetAllocations();
+	timer.GetTime();
+
+	for (int r=0; r<runs; ++r){
+		buffer.Reset(WORKERS);
+
+		for (int w=0; w<WORKERS; ++w){
+			vector<PairBuffer::SpherePair>& list = buffer.Worker(w);
+			list.insert(list.end(), lists[w].begin(), lists[w].end());
+		}
+
+		buffer.Merge();
+	}
+
+	float bufferTime = timer.GetTime();
+	long long bufferAllocations = GetAllocations() - before;
+
+	printf("%d pairs found, %d unique, %d runs\n", found, setSize, runs);
+	printf("  std::set:   %.1f us per merge\n", setTime * 1000.0f / runs);
+	PrintAllocations("merge", setAllocations, runs);
+	printf("  PairBuffer: %.1f us per merge\n", bufferTime * 1000.0f / runs);
+	PrintAllocations("merge", bufferAllocations, runs);
+
+	//Both must give the same pairs, in the same order
+	std::set<PairBuffer::SpherePair> set;
+	for (int w=0; w<WORKERS; ++w){
+		set.insert(lists[w].begin(), lists[w].end());
+	}
+
+	const vector<PairBuffer::SpherePair>& merged = buffer.GetMerged();
+	bool same = merged.size() == set.size() && std::equal(merged.begin(), merged.end(), set.begin());
+
+	printf("  %s\n", same ? "The merged pairs match the set" : "THE MERGED PAIRS DO NOT MATCH THE SET");
+
+	return same ? 0 : 1;
+}
+
+int Benchmark::Scaling(int argc, char** argv){
+	int spheres = Argument(argc, argv, 0, 100000);
+	int maxThreads = Argument(argc, argv, 1, std::thread::hardware_concurrency());
+	int steps = Argument(argc, argv, 2, 10);
+
+	if (maxThreads < 1) maxThreads = 1;
+
+	//The world of the allocations benchmark holds 200 spheres, so this one is grown to
+	//hold the same number per unit of volume
+	float range = RANGE * pow(spheres / 200.0f, 1.0f / 3.0f);
+
+	//Deep enough for the leaves to hold a few spheres each
+	int maxDepth = 1;
+	while (maxDepth < 10 && pow(8.0f, maxDepth) * 4 < spheres){
+		++maxDepth;
+	}
+
+	printf("%d spheres, depth %d, %d steps\n", spheres, maxDepth, steps);
+
+	for (int threads = 1; ; threads *= 2){
+		//The last count is the most threads asked for, even if it is not a power of 2
+		if (threads > maxThreads) threads = maxThreads;
+
+		Verlet v(Vector3(range, range, range), 2, maxDepth, POINTER_OCTREE, 0.0f, threads);
+		vector<Sphere*> created;
+		FillScene(v, spheres, range, true, created);
+
+		v.update(STEP);
+
+		GameTimer timer;
+
+		for (int i=0; i<steps; ++i){
+			v.update(STEP);
+		}
+
+		printf("  %d %s: %.2f ms per step\n", threads, threads == 1 ? "thread" : "threads", timer.GetTime() / steps);
+
+		if (threads == maxThreads) break;
+	}
+
+	return 0;
+}
+
+int Benchmark::Maths(int argc, char** argv){
+	int items = Argument(argc, argv, 0, 100000);
+	int runs = Argument(argc, argv, 1, 5);
+
+	if (items < 2) items = 2;
+	if (runs < 1) runs = 1;
+
+	srand(1);
+
+	const int MATRICES = 1000;
+	vector<Matrix4> matrices(MATRICES);
+	for (int i=0; i<MATRICES; ++i){
+		matrices[i] = Matrix4::Rotation(static_cast<float>(i), Vector3(1, 2, 3)) * Matrix4::Translation(Vector3(static_cast<float>(i), 1, 2));
+	}
+
+	vector<Vector3> points(items);
+	for (int i=0; i<items; ++i){
+		float x = (rand() % 100) * 0.1f;
+		float y = (rand() % 100) * 0.1f;
+		float z = (rand() % 100) * 0.1f;
+		points[i] = Vector3(x, y, z);
+	}
+
+	vector<Matrix4> products(items), scalarProducts(items);
+	vector<Vector3> transformed(items), batched(items), scalarTransformed(items);
+	vector<float> distances(items), powDistances(items);
+	vector<float> dots(items), sseDots(items), magnitudes(items), sseMagnitudes(items);
+	vector<Vector3> normalised(items), scalarNormalised(items);
+
+	//The time of each way in this run, and the best over every run, in ms
+	const int TIMES = 13;
+	float times[TIMES], best[TIMES];
+	for (int i=0; i<TIMES; ++i) best[i] = 1e9f;
+
+	GameTimer timer;
+
+	for (int r=0; r<runs; ++r){
+		timer.GetTime();
+		for (int i=0; i<items; ++i) products[i] = matrices[i % MATRICES] * matrices[(i + 1) % MATRICES];
+		times[0] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) scalarProducts[i] = ScalarProduct(matrices[i % MATRICES], matrices[(i + 1) % MATRICES]);
+		times[1] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) transformed[i] = matrices[7] * points[i];
+		times[2] = timer.GetTime();
+
+		matrices[7].Transform(&points[0], &batched[0], items);
+		times[3] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) scalarTransformed[i] = ScalarTransform(matrices[7], points[i]);
+		times[4] = timer.GetTime();
+
+		for (int i=1; i<items; ++i) distances[i] = points[i].GetDistanceNSq(points[i - 1]);
+		times[5] = timer.GetTime();
+
+		for (int i=1; i<items; ++i) powDistances[i] = PowDistanceNSq(points[i], points[i - 1]);
+		times[6] = timer.GetTime();
+
+		for (int i=1; i<items; ++i) dots[i] = points[i].DotProduct(points[i - 1]);
+		times[7] = timer.GetTime();
+
+		for (int i=1; i<items; ++i) sseDots[i] = SseDotProduct(points[i], points[i - 1]);
+		times[8] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) magnitudes[i] = points[i].GetMagnitude();
+		times[9] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) sseMagnitudes[i] = SseMagnitude(points[i]);
+		times[10] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) normalised[i] = points[i].GetNormalised();
+		times[11] = timer.GetTime();
+
+		for (int i=0; i<items; ++i) scalarNormalised[i] = ScalarNormalised(points[i]);
+		times[12] = timer.GetTime();
+
+		//min is a macro, so the times are taken before it compares them
+		for (int i=0; i<TIMES; ++i) best[i] = min(best[i], times[i]);
+	}
+
+	//The SSE code adds in the same order as the scalar code, so must match it exactly.
+	//Only pow rounds differently, so distances are compared to a small tolerance.
+	int mismatches = 0;
+
+	for (int i=0; i<items; ++i){
+		for (int j=0; j<16; ++j){
+			if (products[i].values[j] != scalarProducts[i].values[j]) mismatches++;
+		}
+
+		//Vector3's == allows a small difference, so each axis is compared exactly
+		const Vector3& t = transformed[i];
+		const Vector3& b = batched[i];
+		const Vector3& s = scalarTransformed[i];
+
+		if (t.x != s.x || t.y != s.y || t.z != s.z || b.x != s.x || b.y != s.y || b.z != s.z) mismatches++;
+
+		if (i > 0 && fabs(distances[i] - powDistances[i]) > 1e-5f * max(powDistances[i], 1.0f)) mismatches++;
+
+		if (dots[i] != sseDots[i] || magnitudes[i] != sseMagnitudes[i]) mismatches++;
+
+		const Vector3& n = normalised[i];
+		const Vector3& sn = scalarNormalised[i];
+
+		//A zero point normalises to not-a-number both ways, which never compares equal
+		if (points[i].GetMagnitude() > 0.0f && (n.x != sn.x || n.y != sn.y || n.z != sn.z)) mismatches++;
+	}
+
+	printf("%d items, best of %d runs (ms)\n", items, runs);
+	printf("  matrix products:   %.3f  (scalar %.3f)\n", best[0], best[1]);
+	printf("  point transforms:  %.3f  batched %.3f  (scalar %.3f)\n", best[2], best[3], best[4]);
+	printf("  squared distances: %.3f  (pow %.3f)\n", best[5], best[6]);
+	printf("  dot products:      %.3f  (SSE %.3f)\n", best[7], best[8]);
+	printf("  magnitudes:        %.3f  (SSE %.3f)\n", best[9], best[10]);
+	printf("  normalises:        %.3f  (scalar %.3f)\n", best[11], best[12]);
+	printf("  %d results differ between the ways\n", mismatches);
+
+	return mismatches == 0 ? 0 : 1;
+}
+
+int Benchmark::Sleep(int argc, char** argv){
+	int spheres = Argument(argc, argv, 0, 64);
+	int steps = Argument(argc, argv, 1, 1800);
+
+	//The spheres are dropped in a column onto a wide floor, and pile up where they land.
+	//There are no walls to hold the pile in, as a sphere pressed against a wall by the
+	//rest of the pile is bounced off it every step, and never rests.
+	const float COLUMN = 8.0f;
+	float floor = -RANGE / 2 + 1.0f;
+
+	Verlet v(Vector3(RANGE, RANGE, RANGE));
+	v.CreateBox(Vector3(0, floor - 0.5f, 0), Vector3(RANGE / 2, 0.5f, RANGE / 2));
+
+	srand(1);
+
+	for (int i=0; i<spheres; ++i){
+		float x = ((rand() % 1000) / 1000.0f - 0.5f) * COLUMN;
+		float y = floor + 1.0f + (rand() % 1000) / 1000.0f * RANGE * 0.5f;
+		float z = ((rand() % 1000) / 1000.0f - 0.5f) * COLUMN;
+		float radius = 0.5f + (rand() % 50) / 100.0f;
+		float mass = static_cast<float>(rand() % 10 + 1);
+
+		v.CreateSphere(Vector3(x, y, z), radius, mass, 0.99f);
+	}
+
+	v.ApplyGravity();
+
+	printf("%d spheres dropped onto a floor, %d steps\n", spheres, steps);
+
+	//Each step is timed while the pile settles and once it is asleep
+	GameTimer timer;
+	float settling = 0.0f;
+	float asleep = 0.0f;
+	int asleepAt = -1;
+
+	for (int i=0; i<steps; ++i){
+		v.update(STEP);
+
+		float time = timer.GetTime();
+		bool sleeping = v.GetAwakeCount() == 0;
+
+		if (sleeping && asleepAt < 0){
+			asleepAt = i + 1;
+		}
+
+		if (asleepAt < 0){
+			settling += time;
+		} else {
+			asleep += time;
+		}
+
+		//Once a second of the simulation
+		if ((i + 1) % 60 == 0 && (asleepAt < 0 || asleepAt > i + 1 - 60)){
+			printf("  %5.1f s: %d awake\n", (i + 1) * STEP, v.GetAwakeCount());
+		}
+	}
+
+	if (asleepAt < 0){
+		printf("  THE PILE NEVER FELL ASLEEP\n");
+		printf("  %.3f ms per step\n", settling / steps);
+		return 1;
+	}
+
+	printf("  Asleep after %d steps (%.1f s)\n", asleepAt, asleepAt * STEP);
+	printf("  %.3f ms per step while settling\n", settling / asleepAt);
+
+	if (asleepAt < steps){
+		printf("  %.3f ms per step once asleep\n", asleep / (steps - asleepAt));
+	}
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+
+class Verlet;
+class Sphere;
+
+using std::vector;
+
+/**
+* Headless benchmarks of the physics engine, run in place of the simulation when the
+* program is started with -bench followed by the name of a benchmark and its
+* arguments, for example "-bench allocations 2000 5". Nothing is drawn, so no window
+* is opened, and each benchmark prints its figures to the console.
+*
+* When built with BENCHMARK_ALLOCATIONS defined, every allocation the program makes
+* through operator new is counted, so the benchmarks can report how often the engine
+* goes to the heap. The count costs an atomic increment per allocation, so it is left
+* out of normal builds.
+*/
+class Benchmark
+{
+public:
+	//The size of the world the benchmark scenes are made in, along each axis
+	static const float RANGE;
+
+	//The time each step of a benchmark simulates
+	static const float STEP;
+
+	//Runs the benchmark named by the first argument, passing it the rest. Returns the
+	//program's exit code, which is not 0 if there is no such benchmark.
+	static int Run(int argc, char** argv);
+
+	//Whether allocations are counted, which they are only when built with
+	//BENCHMARK_ALLOCATIONS defined
+	static bool CountsAllocations();
+
+	//The number of allocations made through operator new since the program started,
+	//or 0 if they are not counted
+	static long long GetAllocations();
+
+protected:
+	//The allocations and time of each Verlet::update in a scene of moving spheres.
+	//Arguments: [spheres = 200] [maxDepth = 3] [steps = 300]
+	static int Allocations(int argc, char** argv);
+
+	//The time and allocations of merging the pairs found by the workers into one list
+	//of unique pairs, with a PairBuffer and with a std::set as the broad phases used
+	//to, checking both give the same pairs in the same order.
+	//Arguments: [pairs = 10000] [runs = 200]
+	static int Pairs(int argc, char** argv);
+
+	//The time of each Verlet::update in a scene of moving spheres, as the number of
+	//threads the engine shares its work between doubles from 1 up to the supplied
+	//number. The world grows with the number of spheres, so they are as crowded as in
+	//the other scenes.
+	//Arguments: [spheres = 100000] [maxThreads = hardware threads] [steps = 10]
+	static int Scaling(int argc, char** argv);
+
+	//The time of matrix products, point transforms, squared distances and normalises,
+	//with the math types and with the scalar code they replaced, and of dot products and
+	//magnitudes with the math types and with SSE, checking both ways give the same
+	//results. Each is timed at its best of a number of runs.
+	//Arguments: [items = 100000] [runs = 5]
+	static int Maths(int argc, char** argv);
+
+	//A pile of spheres dropped onto a floor under gravity, reporting how many are awake
+	//each second and the step the whole island falls asleep at, along with the time of
+	//a step while it settles and once it sleeps. Fails if it never falls asleep.
+	//Arguments: [spheres = 64] [steps = 1800]
+	static int Sleep(int argc, char** argv);
+
+	//Returns the integer argument at the supplied index, or the default if there are
+	//not that many arguments
+	static int Argument(int argc, char** argv, int index, int fallback);
+
+	//Prints the number of allocations made for each of a count of things, if they
+	//are counted
+	static void PrintAllocations(const char* what, long long made, int count);
+
+	//Fills an engine with randomly placed spheres inside a box of planes at the edges
+	//of a world of the supplied size. The random numbers are seeded the same way
+	//every time, so a scene is the same from run to run. Moving spheres are given a
+	//random velocity. The spheres created are added to the supplied list.
+	static void FillScene(Verlet& v, int spheres, float range, bool moving, vector<Sphere*>& created);
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include "Vector3.h"
+#include "Sphere.h"
+
+/**
+* A static axis aligned box spheres collide with. Thin boxes make slabs: floors,
+* walls and ramps of finite size, where a Plane would stretch to infinity. Boxes
+* never move, so the physics engine keeps them in a StaticTree built once.
+*/
+class Box
+{
+public:
+	friend class Verlet;
+	friend class StaticTree;
+
+	//Returns the point in (or on the surface of) the box closest to a point
+	inline Vector3 ClosestPoint(const Vector3& p) const{
+		return Vector3(p.x < low.x ? low.x : (p.x > high.x ? high.x : p.x),
+			p.y < low.y ? low.y : (p.y > high.y ? high.y : p.y),
+			p.z < low.z ? low.z : (p.z > high.z ? high.z : p.z));
+	}
+
+	//Check whether a sphere has collided with this box
+	inline bool Collided(const Sphere& s) const{
+		Vector3 p = s.getPos();
+		Vector3 c = ClosestPoint(p);
+		float dx = p.x - c.x, dy = p.y - c.y, dz = p.z - c.z;
+
+		return dx * dx + dy * dy + dz * dz < s.getRadius() * s.getRadius();
+	}
+
+	//Resolve a collision between a sphere and a box
+	inline void ResolveCollision(Sphere& s, const float& time){
+		Vector3 p = s.getPos();
+		Vector3 c = ClosestPoint(p);
+		Vector3 toCenter = p - c;
+		float distance = toCenter.GetMagnitude();
+
+		Vector3 normal;
+		float peneDepth;
+
+		if (distance > 0.0f){
+			//The sphere is outside the box, and is pushed away from the closest point
+			normal = toCenter / distance;
+			peneDepth = s.getRadius() - distance;
+		} else {
+			//The center of the sphere is inside the box, so push it out of the nearest face
+			float faces[6] = { p.x - low.x, high.x - p.x, p.y - low.y, high.y - p.y, p.z - low.z, high.z - p.z };
+			int nearest = 0;
+
+			for (int i=1; i<6; ++i){
+				if (faces[i] < faces[nearest]) nearest = i;
+			}
+
+			float out = (nearest & 1) ? 1.0f : -1.0f;
+			normal = Vector3(nearest / 2 == 0 ? out : 0.0f, nearest / 2 == 1 ? out : 0.0f, nearest / 2 == 2 ? out : 0.0f);
+			peneDepth = s.getRadius() + faces[nearest];
+		}
+
+		//Only the velocity into the box is reflected, as the box is immovable
+		Vector3 sVelo = s.getVelocity(time);
+		float veloNormal = sVelo.DotProduct(normal);
+
+		if (veloNormal < 0.0f){
+			sVelo -= normal * ((1 + s.getElasticity()) * veloNormal);
+		}
+
+		//Translate the sphere out of collision first, then set its velocity
+		s.translate(normal * peneDepth);
+		s.setVelocity(sVelo, time);
+	}
+
+	//Draws the box's associated render object.
+	inline void Draw(SRenderer& r){
+		r.Render(*ro);
+	}
+
+protected:
+	//The lowest and highest corners of the box
+	Vector3 low;
+	Vector3 high;
+
+	//The renderobject for ease of drawing
+	RenderObject* ro;
+
+	//Protected (con/de)structors to prevent instantiation from outside the
+	//physics engine
+	Box(void);
+
+	//The constructor used by the physics engine. Boxes are static, so their
+	//render objects model matrix is only ever set once.
+	inline Box(const Vector3& position, const Vector3& halfSize){
+		Vector3 center = position;
+		Vector3 extent = halfSize.absolute();
+
+		low = center - extent;
+		high = center + extent;
+
+		//Boxes are green, to tell them apart from the infinite planes
+		ro = new RenderObject(MeshManager::Instance().GetMesh("cube.obj"), ShaderManager::Instance().GetShader("basic"), TextureManager::Instance().GetTexture("green.png"));
+		ro->SetModelMatrix(Matrix4::Translation(center) * Matrix4::Scale(extent));
+		ro->Update(0.0f);
+	}
+
+	~Box(void){
+		delete ro;
+	};
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "Sphere.h"
+#include "PlaneSet.h"
+#include "PairBuffer.h"
+#include "SRenderer.h"
+
+using std::vector;
+
+//The broad phase backends the physics engine can be constructed with
+enum BroadPhaseType {
+	POINTER_OCTREE	= 0,	//A recursive octree of pooled nodes (Octree)
+	LINEAR_OCTREE			//Morton ordered cells in one contiguous array (LinearOctree)
+};
+
+/**
+* The interface the physics engine uses to partition the world. A broad phase
+* stores the spheres in the simulation, keeps itself consistent as they move, and
+* finds and resolves the pairs of spheres that collide.
+*/
+class BroadPhase
+{
+public:
+	virtual ~BroadPhase(void){ };
+
+	//Adds a sphere to the broad phase. Returns false if the sphere lies outside the world.
+	virtual bool AddSphere(Sphere& e) = 0;
+
+	//Adds a batch of spheres to the broad phase. Spheres that lie outside the world are
+	//moved to the end of the batch, and the number of spheres added is returned.
+	virtual int AddSpheres(vector<Sphere*>& batch){
+		int added = 0;
+
+		for (unsigned int i=0; i<batch.size(); ++i){
+			if (AddSphere(*batch[i])){
+				std::swap(batch[added++], batch[i]);
+			}
+		}
+
+		return added;
+	}
+
+	//Removes a sphere from the broad phase
+	virtual void RemoveSphere(Sphere& e) = 0;
+
+	//Update the broad phase to account for the supplied spheres, which are every
+	//sphere that has moved or changed size since the last update
+	virtual void Update(const vector<Sphere*>& changed) = 0;
+
+	//Sets the margin spheres' bounds are grown by so they need updating less often:
+	//velocityScale frames of motion ahead, plus padding all round. Broad phases
+	//that rebuild themselves every update have no use for it.
+	virtual void SetMargin(float velocityScale, float padding){ };
+
+	//Sets the number of times the contacts between spheres are solved each frame
+	virtual void SetSolverIterations(int iterations){ };
+
+	//Tells the broad phase the static planes of the world, so it can work out which
+	//of them each sphere may be touching. Called again whenever a plane is added.
+	virtual void SetPlanes(const PlaneSet& planes){ };
+
+	//Returns the planes the supplied sphere may be colliding with, as a mask of their
+	//indices in the plane set. Broad phases that do not track the planes return them all.
+	virtual PlaneMask NearbyPlanes(const Sphere& e) const{
+		return ALL_PLANES;
+	}
+
+	//Resolve all the collisions of SPHERES in the broad phase
+	virtual void ResolveCollisions(float msec) = 0;
+
+	//The pairs of spheres the last call to ResolveCollisions found colliding, lowest
+	//address first. Kept until collisions are next resolved.
+	virtual const vector<PairBuffer::SpherePair>& GetContacts() const = 0;
+
+	//Pass the broad phase a renderer to have it render its partitions
+	virtual void Draw(SRenderer& r) = 0;
+};
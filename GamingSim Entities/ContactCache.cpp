@@ -0,0 +1,465 @@
+#include "ContactCache.h"
+#include "Sphere.h"
+#include <emmintrin.h>
+
+const float ContactCache::BOUNCE_SPEED = 0.5f;
+const float ContactCache::NORMAL_MATCH = 0.9f;
+
+ContactCache::ContactCache(void)
+{
+	iterations = 4;
+	warmStarted = 0;
+	overflow = 0;
+	batches.push_back(0);
+}
+
+ContactCache::~ContactCache(void)
+{
+}
+
+void ContactCache::Resolve(const vector<PairBuffer::SpherePair>& pairs, float time, ThreadPool* workers){
+	next.clear();
+	order.clear();
+
+	unsigned int old = 0;
+
+	for (unsigned int i=0; i<pairs.size(); ++i){
+		//Contacts of the last frame before this pair were not found again, and are
+		//kept until they are too old
+		while (old < contacts.size() && PairBuffer::SpherePair(contacts[old].a, contacts[old].b) < pairs[i]){
+			if (contacts[old].age < MAX_AGE){
+				next.push_back(contacts[old]);
+				next.back().age++;
+			}
+			old++;
+		}
+
+		//A contact found again keeps its impulse and normal, until it is prepared
+		Contact c;
+		c.a = pairs[i].first;
+		c.b = pairs[i].second;
+		c.normal = Vector3(0, 0, 0);
+		c.impulse = 0.0f;
+		c.age = 0;
+
+		if (old < contacts.size() && contacts[old].a == c.a && contacts[old].b == c.b){
+			c.normal = contacts[old].normal;
+			c.impulse = contacts[old].impulse;
+			old++;
+		}
+
+		//A collision wakes both spheres. Waking moves particles in the store, so it is
+		//done here, before the contacts are shared out between the workers.
+		c.a->wake();
+		c.b->wake();
+
+		order.push_back(next.size());
+		next.push_back(c);
+	}
+
+	for (; old < contacts.size(); ++old){
+		if (contacts[old].age < MAX_AGE){
+			next.push_back(contacts[old]);
+			next.back().age++;
+		}
+	}
+
+	Colour();
+
+	ThreadPool::Job prepare = [&](int begin, int end, int worker){
+		PrepareRange(begin, end, time);
+	};
+
+	//Apply the impulses of the last frame first, then correct them
+	ThreadPool::Job warmStart = [&](int begin, int end, int worker){
+		for (int i = begin; i < end; ++i){
+			Contact& c = next[order[i]];
+
+			if (c.impulse > 0.0f){
+				c.a->applyImpulse(c.normal * c.impulse, time);
+				c.b->applyImpulse(c.normal * -c.impulse, time);
+			}
+		}
+	};
+
+	ThreadPool::Job solve = [&](int begin, int end, int worker){
+		SolveRange(begin, end, time);
+	};
+
+	RunBatches(prepare, workers);
+	RunBatches(warmStart, workers);
+
+	for (int i = 0; i < iterations; ++i){
+		RunBatches(solve, workers);
+	}
+
+	warmStarted = 0;
+	for (unsigned int i=0; i<order.size(); ++i){
+		if (next[order[i]].impulse > 0.0f) warmStarted++;
+	}
+
+	contacts.swap(next);
+}
+
+void ContactCache::Remove(const Sphere& s){
+	//The contacts left keep their order, so they still match the pairs of the next frame
+	unsigned int kept = 0;
+
+	for (unsigned int i=0; i<contacts.size(); ++i){
+		if (contacts[i].a != &s && contacts[i].b != &s){
+			contacts[kept++] = contacts[i];
+		}
+	}
+
+	contacts.erase(contacts.begin() + kept, contacts.end());
+}
+
+void ContactCache::Colour(){
+	//Every sphere in a contact is awake, so its particle is one of the first
+	int highest = -1;
+	for (unsigned int i=0; i<order.size(); ++i){
+		const Contact& c = next[order[i]];
+		highest = max(highest, max(c.a->particle, c.b->particle));
+	}
+
+	if (used.size() < static_cast<unsigned int>(highest + 1)){
+		used.resize(highest + 1, 0);
+	}
+
+	//Give each contact the lowest colour neither of its spheres has used. Contacts
+	//of spheres that have used every colour share the last batch, which is serial.
+	int counts[MAX_COLOURS + 1] = { 0 };
+	colours.resize(order.size());
+
+	for (unsigned int i=0; i<order.size(); ++i){
+		const Contact& c = next[order[i]];
+		unsigned long long open = ~(used[c.a->particle] | used[c.b->particle]);
+
+		int colour = 0;
+		while (colour < MAX_COLOURS && !(open & (1ULL << colour))) colour++;
+
+		if (colour < MAX_COLOURS){
+			used[c.a->particle] |= 1ULL << colour;
+			used[c.b->particle] |= 1ULL << colour;
+		}
+
+		colours[i] = colour;
+		counts[colour]++;
+	}
+
+	//Clear the colours used, ready for the next frame
+	for (unsigned int i=0; i<order.size(); ++i){
+		const Contact& c = next[order[i]];
+		used[c.a->particle] = 0;
+		used[c.b->particle] = 0;
+	}
+
+	//Sort the contacts by colour, keeping their order within each colour
+	int starts[MAX_COLOURS + 1];
+	batches.clear();
+	batches.push_back(0);
+
+	for (int i = 0; i <= MAX_COLOURS; ++i){
+		starts[i] = batches.back();
+		if (counts[i] > 0) batches.push_back(batches.back() + counts[i]);
+	}
+
+	overflow = counts[MAX_COLOURS];
+	scratch.assign(order.begin(), order.end());
+
+	for (unsigned int i=0; i<scratch.size(); ++i){
+		order[starts[colours[i]]++] = scratch[i];
+	}
+}
+
+void ContactCache::RunBatches(const ThreadPool::Job& job, ThreadPool* workers){
+	for (unsigned int b = 0; b + 1 < batches.size(); ++b){
+		int first = batches[b];
+		int size = batches[b + 1] - first;
+
+		//The contacts that did not fit a colour are the last batch, and may share spheres
+		bool shared = overflow > 0 && b + 2 == batches.size();
+
+		if (workers == NULL || size < MIN_PARALLEL_BATCH || shared){
+			job(first, first + size, 0);
+		} else {
+			workers->ParallelFor(size, [&](int begin, int end, int worker){
+				job(first + begin, first + end, worker);
+			});
+		}
+	}
+}
+
+void ContactCache::Prepare(Contact& c, float time){
+	Sphere& a = *c.a;
+	Sphere& b = *c.b;
+
+	//Calculate the contact normal and the depth of the penetration. Spheres at the
+	//same point are pushed apart along any axis.
+	Vector3 between = a.getPos() - b.getPos();
+	float distance = between.GetMagnitude();
+
+	Vector3 lastNormal = c.normal;
+	c.normal = distance > 0.0f ? between / distance : Vector3(0, 1, 0);
+	float penDepth = a.getRadius() + b.getRadius() - distance;
+
+	//Only a contact whose normal has hardly turned since the last frame is warm started
+	if (c.normal.DotProduct(lastNormal) <= NORMAL_MATCH){
+		c.impulse = 0.0f;
+	}
+
+	c.inverseA = 1.0f / a.getMass();
+	c.inverseB = 1.0f / b.getMass();
+	c.mass = 1.0f / (c.inverseA + c.inverseB);
+
+	//Calculate the rough combined elasticity of the two spheres in
+	//the collision. An application of the smoke and mirrors technique!
+	float elasticity = (a.getElasticity() + b.getElasticity()) * 0.5f;
+
+	//Spheres approaching fast enough bounce apart, and the rest just stop
+	float approach = (a.getVelocity(time) - b.getVelocity(time)).DotProduct(c.normal);
+	c.target = approach < -BOUNCE_SPEED ? -elasticity * approach : 0.0f;
+
+	//Translate the shapes out of contact with each other
+	a.translate(c.normal * (penDepth * 0.5f));
+	b.translate(c.normal * (-penDepth * 0.5f));
+}
+
+void ContactCache::Solve(Contact& c, float time){
+	float velocity = (c.a->getVelocity(time) - c.b->getVelocity(time)).DotProduct(c.normal);
+
+	//The total impulse of the contact may push the spheres apart, but never pull them together
+	float impulse = max(c.impulse + (c.target - velocity) * c.mass, 0.0f);
+	float change = impulse - c.impulse;
+	c.impulse = impulse;
+
+	if (change != 0.0f){
+		c.a->applyImpulse(c.normal * change, time);
+		c.b->applyImpulse(c.normal * -change, time);
+	}
+}
+
+void ContactCache::PrepareRange(int begin, int end, float time){
+	//A range never spans two batches, so it is either all in a coloured batch or
+	//all in the last batch of contacts that did not fit a colour
+	int grouped = min(end, static_cast<int>(order.size()) - overflow);
+	int i = begin;
+
+	for (; i + 4 <= grouped; i += 4){
+		Prepare(&order[i], time);
+	}
+
+	for (; i < end; ++i){
+		Prepare(next[order[i]], time);
+	}
+}
+
+void ContactCache::SolveRange(int begin, int end, float time){
+	int grouped = min(end, static_cast<int>(order.size()) - overflow);
+	int i = begin;
+
+	for (; i + 4 <= grouped; i += 4){
+		Solve(&order[i], time);
+	}
+
+	for (; i < end; ++i){
+		Solve(next[order[i]], time);
+	}
+}
+
+//Loads the elements at 4 indices of an array into the lanes of a register
+static inline __m128 Gather(const vector<float>& v, const int* i){
+	return _mm_setr_ps(v[i[0]], v[i[1]], v[i[2]], v[i[3]]);
+}
+
+//Stores the lanes of a register at 4 indices of an array
+static inline void Scatter(__m128 x, vector<float>& v, const int* i){
+	float lanes[4];
+	_mm_storeu_ps(lanes, x);
+
+	v[i[0]] = lanes[0];
+	v[i[1]] = lanes[1];
+	v[i[2]] = lanes[2];
+	v[i[3]] = lanes[3];
+}
+
+//Selects b where the mask is set, and a elsewhere
+static inline __m128 Select(__m128 a, __m128 b, __m128 mask){
+	return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+//Returns the dot product of 4 pairs of vectors
+static inline __m128 Dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz){
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+void ContactCache::Prepare(const int* group, float time){
+	//The spheres of every contact share a store, as they belong to the same engine.
+	//Their state is read and written straight from the arrays of the store.
+	Contact* c[4];
+	int a[4], b[4];
+	float ra[4], rb[4], ia[4], ib[4], ea[4], eb[4], impulse[4], ox[4], oy[4], oz[4];
+
+	for (int k = 0; k < 4; ++k){
+		c[k] = &next[group[k]];
+		a[k] = c[k]->a->particle;
+		b[k] = c[k]->b->particle;
+
+		ra[k] = c[k]->a->radius;
+		rb[k] = c[k]->b->radius;
+		ia[k] = 1.0f / c[k]->a->mass;
+		ib[k] = 1.0f / c[k]->b->mass;
+		ea[k] = c[k]->a->elasticity;
+		eb[k] = c[k]->b->elasticity;
+
+		impulse[k] = c[k]->impulse;
+		ox[k] = c[k]->normal.x;
+		oy[k] = c[k]->normal.y;
+		oz[k] = c[k]->normal.z;
+	}
+
+	ParticleStore& p = *c[0]->a->particles;
+
+	__m128 pax = Gather(p.px, a), pay = Gather(p.py, a), paz = Gather(p.pz, a);
+	__m128 lax = Gather(p.lx, a), lay = Gather(p.ly, a), laz = Gather(p.lz, a);
+	__m128 pbx = Gather(p.px, b), pby = Gather(p.py, b), pbz = Gather(p.pz, b);
+	__m128 lbx = Gather(p.lx, b), lby = Gather(p.ly, b), lbz = Gather(p.lz, b);
+
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	//Find the distances with one reciprocal square root, refined by a step of Newton's
+	//method, rather than a square root and a division
+	__m128 bx = _mm_sub_ps(pax, pbx);
+	__m128 by = _mm_sub_ps(pay, pby);
+	__m128 bz = _mm_sub_ps(paz, pbz);
+	__m128 d2 = Dot(bx, by, bz, bx, by, bz);
+
+	__m128 inverse = _mm_rsqrt_ps(d2);
+	inverse = _mm_mul_ps(_mm_mul_ps(half, inverse),
+		_mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(d2, inverse), inverse)));
+
+	//Spheres at the same point are pushed apart along any axis
+	__m128 apart = _mm_cmpgt_ps(d2, zero);
+	__m128 nx = _mm_and_ps(apart, _mm_mul_ps(bx, inverse));
+	__m128 ny = Select(_mm_set1_ps(1.0f), _mm_mul_ps(by, inverse), apart);
+	__m128 nz = _mm_and_ps(apart, _mm_mul_ps(bz, inverse));
+	__m128 distance = _mm_and_ps(apart, _mm_mul_ps(d2, inverse));
+
+	__m128 penDepth = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(ra), _mm_loadu_ps(rb)), distance);
+
+	//Only contacts whose normals have hardly turned since the last frame are warm started
+	__m128 turn = Dot(nx, ny, nz, _mm_loadu_ps(ox), _mm_loadu_ps(oy), _mm_loadu_ps(oz));
+	__m128 warm = _mm_and_ps(_mm_cmpgt_ps(turn, _mm_set1_ps(NORMAL_MATCH)), _mm_loadu_ps(impulse));
+
+	__m128 mass = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_loadu_ps(ia), _mm_loadu_ps(ib)));
+	__m128 elasticity = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(ea), _mm_loadu_ps(eb)), half);
+
+	//Spheres approaching fast enough bounce apart, and the rest just stop
+	__m128 approach = _mm_div_ps(Dot(
+		_mm_sub_ps(_mm_sub_ps(pax, lax), _mm_sub_ps(pbx, lbx)),
+		_mm_sub_ps(_mm_sub_ps(pay, lay), _mm_sub_ps(pby, lby)),
+		_mm_sub_ps(_mm_sub_ps(paz, laz), _mm_sub_ps(pbz, lbz)),
+		nx, ny, nz), _mm_set1_ps(time));
+	__m128 bounce = _mm_cmplt_ps(approach, _mm_set1_ps(-BOUNCE_SPEED));
+	__m128 target = _mm_and_ps(bounce, _mm_sub_ps(zero, _mm_mul_ps(elasticity, approach)));
+
+	//Translate the shapes out of contact with each other
+	__m128 move = _mm_mul_ps(penDepth, half);
+	__m128 mx = _mm_mul_ps(nx, move);
+	__m128 my = _mm_mul_ps(ny, move);
+	__m128 mz = _mm_mul_ps(nz, move);
+
+	Scatter(_mm_add_ps(pax, mx), p.px, a);
+	Scatter(_mm_add_ps(pay, my), p.py, a);
+	Scatter(_mm_add_ps(paz, mz), p.pz, a);
+	Scatter(_mm_add_ps(lax, mx), p.lx, a);
+	Scatter(_mm_add_ps(lay, my), p.ly, a);
+	Scatter(_mm_add_ps(laz, mz), p.lz, a);
+	Scatter(_mm_sub_ps(pbx, mx), p.px, b);
+	Scatter(_mm_sub_ps(pby, my), p.py, b);
+	Scatter(_mm_sub_ps(pbz, mz), p.pz, b);
+	Scatter(_mm_sub_ps(lbx, mx), p.lx, b);
+	Scatter(_mm_sub_ps(lby, my), p.ly, b);
+	Scatter(_mm_sub_ps(lbz, mz), p.lz, b);
+
+	float nxs[4], nys[4], nzs[4], targets[4], masses[4];
+	_mm_storeu_ps(nxs, nx);
+	_mm_storeu_ps(nys, ny);
+	_mm_storeu_ps(nzs, nz);
+	_mm_storeu_ps(impulse, warm);
+	_mm_storeu_ps(targets, target);
+	_mm_storeu_ps(masses, mass);
+
+	for (int k = 0; k < 4; ++k){
+		c[k]->normal.x = nxs[k];
+		c[k]->normal.y = nys[k];
+		c[k]->normal.z = nzs[k];
+		c[k]->impulse = impulse[k];
+		c[k]->target = targets[k];
+		c[k]->mass = masses[k];
+		c[k]->inverseA = ia[k];
+		c[k]->inverseB = ib[k];
+
+		c[k]->a->Changed();
+		c[k]->b->Changed();
+	}
+}
+
+void ContactCache::Solve(const int* group, float time){
+	Contact* c[4];
+	int a[4], b[4];
+	float nxs[4], nys[4], nzs[4], impulse[4], target[4], mass[4], ia[4], ib[4];
+
+	for (int k = 0; k < 4; ++k){
+		c[k] = &next[group[k]];
+		a[k] = c[k]->a->particle;
+		b[k] = c[k]->b->particle;
+
+		nxs[k] = c[k]->normal.x;
+		nys[k] = c[k]->normal.y;
+		nzs[k] = c[k]->normal.z;
+		impulse[k] = c[k]->impulse;
+		target[k] = c[k]->target;
+		mass[k] = c[k]->mass;
+		ia[k] = c[k]->inverseA;
+		ib[k] = c[k]->inverseB;
+	}
+
+	ParticleStore& p = *c[0]->a->particles;
+
+	__m128 nx = _mm_loadu_ps(nxs), ny = _mm_loadu_ps(nys), nz = _mm_loadu_ps(nzs);
+	__m128 lax = Gather(p.lx, a), lay = Gather(p.ly, a), laz = Gather(p.lz, a);
+	__m128 lbx = Gather(p.lx, b), lby = Gather(p.ly, b), lbz = Gather(p.lz, b);
+
+	const __m128 dt = _mm_set1_ps(time);
+
+	__m128 velocity = _mm_div_ps(Dot(
+		_mm_sub_ps(_mm_sub_ps(Gather(p.px, a), lax), _mm_sub_ps(Gather(p.px, b), lbx)),
+		_mm_sub_ps(_mm_sub_ps(Gather(p.py, a), lay), _mm_sub_ps(Gather(p.py, b), lby)),
+		_mm_sub_ps(_mm_sub_ps(Gather(p.pz, a), laz), _mm_sub_ps(Gather(p.pz, b), lbz)),
+		nx, ny, nz), dt);
+
+	//The total impulse of a contact may push the spheres apart, but never pull them together
+	__m128 old = _mm_loadu_ps(impulse);
+	__m128 total = _mm_max_ps(_mm_add_ps(old,
+		_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(target), velocity), _mm_loadu_ps(mass))), _mm_setzero_ps());
+	_mm_storeu_ps(impulse, total);
+
+	//Change each velocity by impulse / mass, by moving the last positions. The spheres
+	//were recorded as changed when their contacts were prepared.
+	__m128 change = _mm_mul_ps(_mm_sub_ps(total, old), dt);
+	__m128 moveA = _mm_mul_ps(change, _mm_loadu_ps(ia));
+	__m128 moveB = _mm_mul_ps(change, _mm_loadu_ps(ib));
+
+	Scatter(_mm_sub_ps(lax, _mm_mul_ps(nx, moveA)), p.lx, a);
+	Scatter(_mm_sub_ps(lay, _mm_mul_ps(ny, moveA)), p.ly, a);
+	Scatter(_mm_sub_ps(laz, _mm_mul_ps(nz, moveA)), p.lz, a);
+	Scatter(_mm_add_ps(lbx, _mm_mul_ps(nx, moveB)), p.lx, b);
+	Scatter(_mm_add_ps(lby, _mm_mul_ps(ny, moveB)), p.ly, b);
+	Scatter(_mm_add_ps(lbz, _mm_mul_ps(nz, moveB)), p.lz, b);
+
+	for (int k = 0; k < 4; ++k){
+		c[k]->impulse = impulse[k];
+	}
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include "Vector3.h"
+#include "PairBuffer.h"
+#include "ThreadPool.h"
+
+class Sphere;
+
+using std::vector;
+
+/**
+* Resolves the collisions between pairs of spheres, remembering each contact from
+* frame to frame. Every contact keeps the impulse it needed in the last frame, and
+* starts the next frame by applying it again (warm starting), so a resting stack
+* starts each frame already close to balanced rather than settling from nothing.
+* The impulse each contact has applied is never allowed to pull the spheres together.
+*
+* Contacts are kept sorted by their pair of spheres, in the same order the broad
+* phases give their pairs, so the contacts of the last frame are matched to the
+* pairs of this one in a single pass. A contact not found again is kept for a few
+* frames, in case its spheres are only briefly apart, and then forgotten.
+*
+* The contacts are coloured so no sphere is in two contacts of the same colour, and
+* each colour is a batch whose contacts can be solved at the same time by different
+* workers. The batches are solved in turn, over a number of Gauss-Seidel iterations,
+* and the result is the same whatever the number of workers. As no two contacts of a
+* batch share a sphere, the contacts of a batch are prepared and solved 4 at a time
+* with SSE, each lane of a register holding one contact.
+*/
+class ContactCache
+{
+public:
+	//How many frames a contact is kept for after its spheres stop colliding
+	static const int MAX_AGE = 3;
+
+	//The number of colours contacts are split between. Contacts of a sphere with
+	//more contacts than this are solved serially, after the batches.
+	static const int MAX_COLOURS = 64;
+
+	//The fewest contacts in a batch worth sharing out between the workers
+	static const int MIN_PARALLEL_BATCH = 256;
+
+	//The speed spheres must approach each other faster than to bounce apart. Slower
+	//contacts are only stopped, so resting spheres do not keep bouncing off each other.
+	static const float BOUNCE_SPEED;
+
+	//How closely the normal of a contact must match the last frame's to be warm started
+	static const float NORMAL_MATCH;
+
+	ContactCache(void);
+	~ContactCache(void);
+
+	//Resolves the collisions of every pair of spheres, which must be sorted and
+	//unique, as a PairBuffer merges them. Each batch of contacts is shared out
+	//between the workers, or solved serially if there are none.
+	void Resolve(const vector<PairBuffer::SpherePair>& pairs, float time, ThreadPool* workers = NULL);
+
+	//Forgets every contact of a sphere that is being destroyed. Contacts are matched by
+	//their spheres' addresses, so a sphere later made at the same address would
+	//otherwise inherit them.
+	void Remove(const Sphere& s);
+
+	//Sets the number of times every contact is solved each frame. More iterations
+	//let the impulses of a stack reach its bottom in a single frame.
+	inline void SetIterations(int iterations){ this->iterations = iterations > 0 ? iterations : 1; }
+
+	//The number of times every contact is solved each frame
+	inline int GetIterations() const { return iterations; }
+
+	//The number of contacts kept, including those not found in the last frame
+	inline int GetCount() const { return contacts.size(); }
+
+	//The number of contacts of the last frame that were warm started
+	inline int GetWarmStarted() const { return warmStarted; }
+
+	//The number of batches the contacts of the last frame were solved in
+	inline int GetBatchCount() const { return batches.size() - 1; }
+
+protected:
+	struct Contact {
+		//The spheres in contact, lowest address first
+		Sphere* a;
+		Sphere* b;
+
+		//The contact normal, pointing from b to a
+		Vector3 normal;
+
+		//The impulse applied along the normal in the frame the contact was last found
+		float impulse;
+
+		//The normal velocity the solver aims for, and the mass the impulse acts on
+		float target;
+		float mass;
+
+		//The inverse masses of the two spheres
+		float inverseA;
+		float inverseB;
+
+		//The number of frames since the contact was last found
+		int age;
+	};
+
+	//Sets up a contact for this frame and moves its spheres out of each other. The
+	//impulse of the last frame is kept only if the normal still matches.
+	void Prepare(Contact& c, float time);
+
+	//Changes the impulse of a contact so its spheres stop approaching each other
+	void Solve(Contact& c, float time);
+
+	//Prepare and Solve for the 4 contacts at the supplied indices, which must share
+	//no spheres
+	void Prepare(const int* group, float time);
+	void Solve(const int* group, float time);
+
+	//Prepare or solve the contacts of a range of the order, 4 at a time until the
+	//contacts that did not fit a colour are reached
+	void PrepareRange(int begin, int end, float time);
+	void SolveRange(int begin, int end, float time);
+
+	//Splits the contacts found this frame into batches by colour
+	void Colour();
+
+	//Runs a job over the contacts of every batch in turn. The range a job is given
+	//is of indices into the order of the batched contacts.
+	void RunBatches(const ThreadPool::Job& job, ThreadPool* workers);
+
+	int iterations;
+	int warmStarted;
+
+	//The contacts of the last frame, and those being built for this one. Both are kept
+	//between frames so their memory is reused.
+	vector<Contact> contacts;
+	vector<Contact> next;
+
+	//The contacts found this frame, ordered by their batch, and where each batch
+	//starts in the order. The last entry is the end of the last batch.
+	vector<int> order;
+	vector<int> batches;
+
+	//The number of contacts in the last batch that did not fit any colour
+	int overflow;
+
+	//The colour of each contact found this frame, and the colours used by each
+	//sphere's contacts so far, by the index of its particle
+	vector<int> colours;
+	vector<unsigned long long> used;
+
+	//Used to sort the contacts by colour
+	vector<int> scratch;
+};
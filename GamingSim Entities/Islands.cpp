@@ -0,0 +1,110 @@
+#include "Islands.h"
+#include "Sphere.h"
+
+Islands::Islands(float sleepTime)
+{
+	this->sleepTime = sleepTime;
+}
+
+Islands::~Islands(void)
+{
+}
+
+int Islands::Find(int i){
+	while (parent[i] != i){
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+void Islands::Join(int a, int b){
+	a = Find(a);
+	b = Find(b);
+
+	if (a == b) return;
+
+	//The root keeps the least rest of the two islands
+	parent[b] = a;
+	rested[a] = min(rested[a], rested[b]);
+}
+
+void Islands::Wake(Sphere& s){
+	if (s.nextAsleep == NULL) return;
+
+	Sphere* i = &s;
+
+	do {
+		Sphere* next = i->nextAsleep;
+		i->nextAsleep = NULL;
+
+		//The sphere keeps the time it has rested, so an island woken by a touch that
+		//moves nothing goes back to sleep along with whatever touched it. The octree
+		//is told it is awake.
+		i->particles->SetAwake(i->particle, true);
+		i->ro->SetTexture(TextureManager::Instance().GetTexture("green.png"));
+		i->Changed();
+
+		i = next;
+	} while (i != &s);
+}
+
+void Islands::Update(ParticleStore& particles, const vector<PairBuffer::SpherePair>& contacts){
+	//Colliding with a sleeping sphere wakes it, as does any change made to it, so an
+	//awake sphere still in a ring means its island has been disturbed. The spheres
+	//woken join the end of the awake particles, after those visited.
+	for (int i = 0; i < particles.GetAwakeCount(); ++i){
+		Wake(*particles.GetOwner(i));
+	}
+
+	//Only the awake particles, which are the first in the store, are in islands
+	int count = particles.GetAwakeCount();
+
+	parent.resize(count);
+	rested.resize(count);
+	ring.resize(count);
+
+	for (int i = 0; i < count; ++i){
+		parent[i] = i;
+		rested[i] = particles.GetRest(i);
+		ring[i] = NULL;
+	}
+
+	//Every sphere in a contact has just been woken by it, so every contact joins two
+	//awake spheres
+	for (unsigned int i = 0; i < contacts.size(); ++i){
+		Join(contacts[i].first->particle, contacts[i].second->particle);
+	}
+
+	//Link the spheres of every island that has been at rest long enough into a ring.
+	//They are put to sleep afterwards, as sleeping a particle changes the indices the
+	//islands were found by.
+	sleepers.clear();
+
+	for (int i = 0; i < count; ++i){
+		int root = Find(i);
+		if (rested[root] < sleepTime) continue;
+
+		Sphere* s = particles.GetOwner(i);
+		sleepers.push_back(s);
+
+		if (ring[root] == NULL){
+			ring[root] = s;
+			s->nextAsleep = s;
+		} else {
+			s->nextAsleep = ring[root]->nextAsleep;
+			ring[root]->nextAsleep = s;
+		}
+	}
+
+	//Each sphere goes to sleep where it is
+	for (unsigned int i = 0; i < sleepers.size(); ++i){
+		Sphere* s = sleepers[i];
+
+		particles.SetLastPos(s->particle, s->getPos());
+		particles.SetAwake(s->particle, false);
+		s->ro->SetTexture(TextureManager::Instance().GetTexture("brown.png"));
+		s->Changed();
+	}
+}
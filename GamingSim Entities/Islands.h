@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include "PairBuffer.h"
+
+class Sphere;
+class ParticleStore;
+
+using std::vector;
+
+/**
+* Puts spheres to sleep an island at a time. An island is a group of spheres joined
+* by the contacts found in a frame, found with a union-find over the particles of the
+* awake spheres. Each particle adds up how long it has been at rest, and an island
+* only sleeps once every one of its spheres has rested for the sleep time, so a pile
+* sleeps as a whole rather than one awake sphere waking its neighbours over and over.
+*
+* A sleeping island is remembered as a ring through its spheres. When anything wakes
+* one of them (a collision with an awake sphere, or being pushed by the program) the
+* whole island is woken with it.
+*/
+class Islands
+{
+public:
+	//Creates the islands, which sleep once each of their spheres has been at rest for
+	//the supplied time
+	Islands(float sleepTime = 0.5f);
+	~Islands(void);
+
+	//Wakes every sleeping island one of whose spheres has been woken, then finds the
+	//islands of awake spheres joined by the supplied contacts, and puts to sleep each
+	//island that has been at rest for the sleep time
+	void Update(ParticleStore& particles, const vector<PairBuffer::SpherePair>& contacts);
+
+	//Wakes the sleeping island a sphere belongs to, if it is asleep in one
+	void Wake(Sphere& s);
+
+protected:
+	//Returns the particle at the root of a particle's island, halving the path to it
+	int Find(int i);
+
+	//Joins the islands of two particles
+	void Join(int a, int b);
+
+	//The time each island must have been at rest for before it sleeps
+	float sleepTime;
+
+	//The parent of each particle in the union-find. A root is its own parent.
+	vector<int> parent;
+
+	//For each root, the least time any particle in its island has been at rest
+	vector<float> rested;
+
+	//For each root, the first sphere of its island put to sleep this frame, to which
+	//the others are linked
+	vector<Sphere*> ring;
+
+	//The spheres being put to sleep. Kept between frames so its memory is reused.
+	vector<Sphere*> sleepers;
+
+private:
+	//Islands cannot be copied
+	Islands(const Islands&);
+	Islands& operator=(const Islands&);
+};
@@ -0,0 +1,218 @@
+#include "LinearOctree.h"
+
+LinearOctree::LinearOctree(Vector3 size, int maxDepth, ThreadPool* workers)
+{
+	//The world is always based around the origin, as with the pointer octree
+	this->size = size;
+	this->pos = Vector3(0,0,0) - (size * 0.5f);
+
+	//A code only has room for so many levels
+	if (maxDepth > Morton::MAX_DEPTH) maxDepth = Morton::MAX_DEPTH;
+	if (maxDepth < 0) maxDepth = 0;
+	this->maxDepth = maxDepth;
+
+	built = true;
+	this->workers = workers;
+
+	//Create the render object used for rendering a cell
+	cube = new RenderObject(MeshManager::Instance().GetMesh("cube.obj"), ShaderManager::Instance().GetShader("basic"), TextureManager::Instance().GetTexture("yellow.png"));
+}
+
+bool LinearOctree::AddSphere(Sphere& e){
+	//Perform the same bounding box check against the world the pointer octree does
+	Vector3 p = e.getPos();
+	float r = e.getRadius();
+
+	if (p.x + r < pos.x || p.x - r > pos.x + size.x) return false;
+	if (p.y + r < pos.y || p.y - r > pos.y + size.y) return false;
+	if (p.z + r < pos.z || p.z - r > pos.z + size.z) return false;
+
+	e.broadPhaseIndex = spheres.size();
+	spheres.push_back(&e);
+
+	//The cells no longer contain every sphere
+	built = false;
+
+	return true;
+}
+
+void LinearOctree::RemoveSphere(Sphere& e){
+	//Swap the last sphere into its place in the list of spheres
+	Sphere* last = spheres.back();
+	spheres[e.broadPhaseIndex] = last;
+	last->broadPhaseIndex = e.broadPhaseIndex;
+	spheres.pop_back();
+
+	e.broadPhaseIndex = -1;
+
+	//The cells still refer to the sphere
+	built = false;
+
+	contacts.Remove(e);
+}
+
+void LinearOctree::Update(const vector<Sphere*>& changed){
+	//Nothing has moved, so the cells are still correct
+	if (built && changed.empty()) return;
+
+	//Otherwise every sphere is re-sorted from scratch. This is a linear pass plus a
+	//sort of a contiguous array, which is cheaper than reinserting into a tree.
+	Build();
+}
+
+void LinearOctree::Build(){
+	entries.clear();
+
+	for (unsigned int i=0; i<spheres.size(); ++i){
+		AddEntries(i);
+	}
+
+	//Sort so that each cell is followed by every cell beneath it
+	std::sort(entries.begin(), entries.end(), EntryLess);
+
+	cells.clear();
+	cellSpheres.resize(entries.size());
+
+	//Group equal codes and depths into cells
+	for (unsigned int i=0; i<entries.size(); ++i){
+		if (cells.empty() || cells.back().code != entries[i].code || cells.back().depth != entries[i].depth){
+			LinearCell c;
+			c.code = entries[i].code;
+			c.depth = entries[i].depth;
+			c.first = i;
+			c.count = 0;
+			cells.push_back(c);
+		}
+
+		cells.back().count++;
+		cellSpheres[i] = spheres[entries[i].sphere];
+	}
+
+	built = true;
+}
+
+void LinearOctree::AddEntries(int sphere){
+	Vector3 p = spheres[sphere]->getPos();
+	float r = spheres[sphere]->getRadius();
+
+	//Place the sphere at the deepest level whose cells are at least as wide as it is.
+	//This way it can never overlap more than 2 cells along any axis.
+	float smallestAxis = min(size.x, min(size.y, size.z));
+	int depth = maxDepth;
+
+	while (depth > 0 && (smallestAxis / (1 << depth)) < (r * 2.0f)){
+		depth--;
+	}
+
+	//Find the range of cells the sphere's bounding box covers at that depth
+	int resolution = 1 << depth;
+	Vector3 cellSize = size / static_cast<float>(resolution);
+
+	Vector3 lowest = ((p - r) - pos) / cellSize;
+	Vector3 highest = ((p + r) - pos) / cellSize;
+
+	//Spheres entirely outside of the world are not stored
+	if (highest.x < 0 || highest.y < 0 || highest.z < 0) return;
+	if (lowest.x > resolution || lowest.y > resolution || lowest.z > resolution) return;
+
+	int lo[3] = { static_cast<int>(lowest.x), static_cast<int>(lowest.y), static_cast<int>(lowest.z) };
+	int hi[3] = { static_cast<int>(highest.x), static_cast<int>(highest.y), static_cast<int>(highest.z) };
+
+	//Clamp the range to the world
+	for (int a=0; a<3; ++a){
+		if (lo[a] < 0) lo[a] = 0;
+		if (hi[a] > resolution - 1) hi[a] = resolution - 1;
+	}
+
+	//Codes are shifted down to the deepest level so all cells share one ordering
+	int shift = 3 * (maxDepth - depth);
+
+	for (int x = lo[0]; x <= hi[0]; ++x){
+		for (int y = lo[1]; y <= hi[1]; ++y){
+			for (int z = lo[2]; z <= hi[2]; ++z){
+				Entry e;
+				e.code = Morton::Encode(x, y, z) << shift;
+				e.depth = depth;
+				e.sphere = sphere;
+				entries.push_back(e);
+			}
+		}
+	}
+}
+
+void LinearOctree::CellBounds(const LinearCell& cell, Vector3& cellPos, Vector3& cellSize) const{
+	unsigned int x, y, z;
+	Morton::Decode(cell.code >> (3 * (maxDepth - cell.depth)), x, y, z);
+
+	cellSize = size / static_cast<float>(1 << cell.depth);
+	cellPos = Vector3(pos.x + (x * cellSize.x), pos.y + (y * cellSize.y), pos.z + (z * cellSize.z));
+}
+
+void LinearOctree::ResolveCollisions(float msec){
+	//Spheres may have been added since the last update
+	if (!built){
+		Build();
+	}
+
+	//Each worker fills its own list of pairs, so no locking is needed
+	int workerCount = workers != NULL ? workers->GetWorkerCount() : 1;
+	pairs.Reset(workerCount);
+
+	ThreadPool::Job job = [&](int begin, int end, int worker){
+		for (int c = begin; c < end; ++c){
+			CheckCell(c, pairs.Worker(worker));
+		}
+	};
+
+	if (workers != NULL){
+		workers->ParallelFor(cells.size(), job);
+	} else {
+		job(0, cells.size(), 0);
+	}
+
+	//Merge the lists into one sorted list of pairs. Spheres that straddle cells are
+	//found once per cell, and the merge removes the duplicates. Each pair that collides
+	//is resolved, warm started from the last frame if it was colliding then too.
+	contacts.Resolve(pairs.Merge(), msec, workers);
+}
+
+void LinearOctree::CheckCell(unsigned int c, vector<pair<Sphere*, Sphere*>>& toBeResolved){
+	const LinearCell& cell = cells[c];
+	int end = cell.first + cell.count;
+
+	//HERE WE START THE n^2 check within the cell
+	for (int i = cell.first; i < end; ++i){
+		for (int j = i + 1; j < end; ++j){
+			CheckPair(cellSpheres[i], cellSpheres[j], toBeResolved);
+		}
+	}
+
+	//The cells beneath this cell are the ones that immediately follow it,
+	//up until the end of this cell's range of codes.
+	unsigned int lastCode = cell.code + Span(cell.depth);
+
+	for (unsigned int d = c + 1; d < cells.size() && cells[d].code < lastCode; ++d){
+		int childEnd = cells[d].first + cells[d].count;
+
+		for (int i = cell.first; i < end; ++i){
+			for (int j = cells[d].first; j < childEnd; ++j){
+				CheckPair(cellSpheres[i], cellSpheres[j], toBeResolved);
+			}
+		}
+	}
+}
+
+void LinearOctree::Draw(SRenderer& r){
+	for (unsigned int c=0; c<cells.size(); ++c){
+		Vector3 cellPos, cellSize;
+		CellBounds(cells[c], cellPos, cellSize);
+
+		//Set the appropriate model matrix
+		cube->SetModelMatrix(Matrix4::Translation(cellPos + (cellSize / 2)) *
+			Matrix4::Scale(cellSize / 2));
+		//Perform a ghost update (To set world transform == modelMatrix)
+		cube->Update(0.0f);
+
+		r.Render(*cube);
+	}
+}
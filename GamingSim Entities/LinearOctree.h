@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "BroadPhase.h"
+#include "Morton.h"
+#include "ThreadPool.h"
+#include "PairBuffer.h"
+#include "ContactCache.h"
+
+#include "MeshManager.h"
+#include "ShaderManager.h"
+#include "TextureManager.h"
+
+using std::vector;
+using std::pair;
+
+//A "LinearCell" is one cell of a linear octree. Cells store no bounds, their position
+//and size are derived from their code and depth.
+struct LinearCell {
+	//The Morton code of the cell, shifted down to the deepest level of the tree. This
+	//makes it the first code of the range of deepest cells the cell covers.
+	unsigned int code;
+
+	//The number of parents the cell has. A depth of 0 is the whole world.
+	int depth;
+
+	//The index of the cell's first sphere in the sorted sphere array, and how many it has
+	int first;
+	int count;
+};
+
+/**
+* An octree that stores no nodes, only the occupied cells, in one contiguous array
+* sorted by Morton code.
+*
+* Each sphere is placed at the deepest level whose cells are at least as wide as the
+* sphere, and is stored in every cell of that level it overlaps (at most 8). As cells
+* are sorted by code, every cell is immediately followed by the cells beneath it, so
+* the broad phase is a single forward walk of the array with no stack and no pointers.
+*/
+class LinearOctree : public BroadPhase
+{
+public:
+	//Creates a linear octree from - 1/2 size to 1/2 size. maxDepth is clamped to the
+	//deepest level a Morton code can describe. If supplied, the workers are used to
+	//search the cells for collisions in parallel.
+	LinearOctree(Vector3 size, int maxDepth, ThreadPool* workers = NULL);
+	~LinearOctree(void){ };
+
+	//Adds a sphere to the tree. The cells are rebuilt on the next update.
+	virtual bool AddSphere(Sphere& e);
+
+	//Removes a sphere from the tree, and forgets its contacts. The cells are rebuilt on
+	//the next update.
+	virtual void RemoveSphere(Sphere& e);
+
+	//Rebuilds the sorted cell array from the current positions of every sphere,
+	//unless no sphere has changed since the last build
+	virtual void Update(const vector<Sphere*>& changed);
+
+	//Resolve all the collisions of SPHERES in the tree
+	virtual void ResolveCollisions(float msec);
+
+	//Sets the number of times the contacts between spheres are solved each frame
+	virtual void SetSolverIterations(int iterations){ contacts.SetIterations(iterations); }
+
+	//The pairs of spheres found colliding by the last resolve
+	virtual const vector<PairBuffer::SpherePair>& GetContacts() const { return pairs.GetMerged(); }
+
+	//Pass the tree a renderer to have it render its occupied cells
+	virtual void Draw(SRenderer& r);
+
+	//The number of occupied cells in the tree
+	inline int GetCellCount() const { return cells.size(); }
+
+	//The number of sphere references held by the cells (spheres that straddle
+	//cells are counted once per cell)
+	inline int GetEntryCount() const { return cellSpheres.size(); }
+
+protected:
+	//One sphere in one cell, used to sort the spheres into cell order
+	struct Entry {
+		unsigned int code;
+		int depth;
+		int sphere;
+	};
+
+	//Orders entries by code, then with parents before their children
+	static bool EntryLess(const Entry& a, const Entry& b){
+		if (a.code != b.code) return a.code < b.code;
+		if (a.depth != b.depth) return a.depth < b.depth;
+		return a.sphere < b.sphere;
+	}
+
+	//The lowest corner and the size of the world
+	Vector3 pos;
+	Vector3 size;
+
+	//The depth of the smallest cells
+	int maxDepth;
+
+	//Whether the cells reflect every sphere that has been added
+	bool built;
+
+	//Every sphere in the tree, in the order they were added
+	vector<Sphere*> spheres;
+
+	//Scratch space used to sort the spheres into cells. Kept between
+	//builds so its memory is reused.
+	vector<Entry> entries;
+
+	//The occupied cells, sorted by code
+	vector<LinearCell> cells;
+
+	//The spheres of each cell, stored contiguously in cell order
+	vector<Sphere*> cellSpheres;
+
+	//A RenderObject for easy rendering of the cells
+	RenderObject* cube;
+
+	//The threads used to search the cells for collisions. NULL to search serially.
+	ThreadPool* workers;
+
+	//The pairs found in the cells, kept between frames so their memory is reused
+	PairBuffer pairs;
+
+	//The contacts between spheres, remembered from frame to frame
+	ContactCache contacts;
+
+	//Sorts every sphere into the cells it overlaps
+	void Build();
+
+	//Adds an entry for every cell the supplied sphere overlaps
+	void AddEntries(int sphere);
+
+	//Derives the bounds of a cell from its code and depth
+	void CellBounds(const LinearCell& cell, Vector3& cellPos, Vector3& cellSize) const;
+
+	//The number of codes at the deepest level that a cell of the supplied depth covers
+	inline unsigned int Span(int depth) const{
+		return 1u << (3 * (maxDepth - depth));
+	}
+
+	//Checks a cell's spheres against each other and the spheres of the cells beneath it
+	void CheckCell(unsigned int c, vector<pair<Sphere*, Sphere*>>& toBeResolved);
+
+	//Narrow phase check for a pair of spheres. If colliding, adds them to the list of
+	//sphere pairs to have their collisions resolved.
+	inline void CheckPair(Sphere* i, Sphere* j, vector<pair<Sphere*, Sphere*>>& toBeResolved){
+		//Two sleeping spheres are at rest against each other
+		if (j != i && (i->getAwake() || j->getAwake())){
+			if (j->CheckCollision(*i)){
+				toBeResolved.push_back(PairBuffer::Ordered(i, j));
+			}
+		}
+	}
+
+private:
+	//Cant declare a linear octree without a defined size!
+	LinearOctree(void);
+};
@@ -3,6 +3,7 @@
 #include "GameTimer.h"
 #include "Verlet.h"
 #include <bitset>
+#include <cstring>
 
 #include <sfml/Window.hpp>
 #include <sfml/Graphics.hpp>
@@ -10,6 +11,7 @@
 #include <sfml/OpenGL.hpp>
 
 #include "SRenderer.h"
+#include "Benchmark.h"
 
 using std::bitset;
 
@@ -26,9 +28,16 @@ A/D		Rotate camera around the y axis, 0.5 degree per press
 UP/DOWN Rotate camera around the x axis, 0.5 degree per press
 Y		Toggle display of Octree
 G		Toggle gravity
+
+Run with -bench followed by a benchmark's name to run a benchmark instead of the
+simulation (see Benchmark).
 */
-int main()
+int main(int argc, char** argv)
 {
+	//Benchmarks draw nothing, so need no window
+	if (argc > 1 && strcmp(argv[1], "-bench") == 0){
+		return Benchmark::Run(argc - 2, argv + 2);
+	}
 
 	//Create window
 	sf::RenderWindow window(sf::VideoMode(SCREEN_WIDTH, SCREEN_HEIGHT), "Gaming Simulations");
@@ -68,6 +77,9 @@ int main()
 	//Create Physics Engine
 	Verlet v(Vector3(RANGE,RANGE,RANGE), 2, 3);
 
+	//Give the spheres two frames of motion of room in the octree before they need moving
+	v.SetBroadPhaseMargin(2.0f, 0.1f);
+
 	//Create some Sphere
 	for (int i=0; i < UNITS; ++i){
 		//Create a sphere at a random position, with random radius, and random mass, drag of 0.99, and elasticty of 0.9
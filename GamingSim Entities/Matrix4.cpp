@@ -8,10 +8,6 @@ Matrix4::Matrix4( float elements[16] )	{
 	memcpy(this->values,elements,16*sizeof(float));
 }
 
-Matrix4::~Matrix4(void)	{
-	ToIdentity();
-}
-
 void Matrix4::ToIdentity() {
 	ToZero();
 	values[0]  = 1.0f;
@@ -26,6 +22,20 @@ void Matrix4::ToZero()	{
 	}
 }
 
+void Matrix4::Transform(const Vector3* points, Vector3* out, int count) const{
+	__m128 c0 = _mm_loadu_ps(&values[0]);
+	__m128 c1 = _mm_loadu_ps(&values[4]);
+	__m128 c2 = _mm_loadu_ps(&values[8]);
+	__m128 c3 = _mm_loadu_ps(&values[12]);
+
+	for (int i = 0; i < count; ++i){
+		float p[4];
+		_mm_storeu_ps(p, Combine(c0, c1, c2, c3, points[i].x, points[i].y, points[i].z, 1.0f));
+
+		out[i] = Vector3(p[0]/p[3], p[1]/p[3], p[2]/p[3]);
+	}
+}
+
 Vector3 Matrix4::GetPositionVector() const{
 	return Vector3(values[12],values[13],values[14]);
 }
@@ -16,6 +16,7 @@ _-_-_-_-_-_-_-""  ""
 #pragma once
 
 #include <iostream>
+#include <xmmintrin.h>
 #include "common.h"
 #include "Vector3.h"
 #include "Vector4.h"
@@ -26,7 +27,6 @@ class Matrix4	{
 public:
 	Matrix4(void);
 	Matrix4(float elements[16]);
-	~Matrix4(void);
 
 	float	values[16];
 
@@ -112,47 +112,36 @@ public:
 	static Matrix4 BuildViewMatrix(const Vector3 &from, const Vector3 &lookingAt, const Vector3 up = Vector3(0,1,0));
 
 	//Multiplies 'this' matrix by matrix 'a'. Performs the multiplication in 'OpenGL' order (ie, backwards)
-	inline Matrix4 operator*(const Matrix4 &a) const{	
-		Matrix4 out;
-		//Students! You should be able to think up a really easy way of speeding this up...
+	inline Matrix4 operator*(const Matrix4 &a) const{
+		//Each column of the result is the columns of this matrix weighted by the
+		//elements of a column of 'a', 4 rows at a time
+		float out[16];
+
 		for(unsigned int r = 0; r < 4; ++r) {
-			for(unsigned int c = 0; c < 4; ++c) {
-				out.values[c + (r*4)] = 0.0f;
-				for(unsigned int i = 0; i < 4; ++i) {
-					out.values[c + (r*4)] += this->values[c+(i*4)] * a.values[(r*4)+i];
-				}
-			}
+			_mm_storeu_ps(&out[r*4], Combine(a.values[r*4], a.values[(r*4)+1], a.values[(r*4)+2], a.values[(r*4)+3]));
 		}
-		return out;
+
+		return Matrix4(out);
 	}
 
 	inline Vector3 operator*(const Vector3 &v) const {
-		Vector3 vec;
-
-		float temp;
-
-		vec.x = v.x*values[0] + v.y*values[4] + v.z*values[8]  + values[12];
-		vec.y = v.x*values[1] + v.y*values[5] + v.z*values[9]  + values[13];
-		vec.z = v.x*values[2] + v.y*values[6] + v.z*values[10] + values[14];
-
-		temp =  v.x*values[3] + v.y*values[7] + v.z*values[11] + values[15];
-
-		vec.x = vec.x/temp;
-		vec.y = vec.y/temp;
-		vec.z = vec.z/temp;
+		float out[4];
+		_mm_storeu_ps(out, Combine(v.x, v.y, v.z, 1.0f));
 
-		return vec;
+		return Vector3(out[0]/out[3], out[1]/out[3], out[2]/out[3]);
 	};
 
 	inline Vector4 operator*(const Vector4 &v) const {
-		return Vector4(
-			v.x*values[0] + v.y*values[4] + v.z*values[8]  +v.w * values[12],
-			v.x*values[1] + v.y*values[5] + v.z*values[9]  +v.w * values[13],
-			v.x*values[2] + v.y*values[6] + v.z*values[10] +v.w * values[14],
-			v.x*values[3] + v.y*values[7] + v.z*values[11] +v.w * values[15]
-		);
+		float out[4];
+		_mm_storeu_ps(out, Combine(v.x, v.y, v.z, v.w));
+
+		return Vector4(out[0], out[1], out[2], out[3]);
 	};
 
+	//Transforms an array of points, as multiplying by each point does, into another
+	//array. The columns of the matrix are only loaded once.
+	void Transform(const Vector3* points, Vector3* out, int count) const;
+
 	//Handy string output for the matrix. Can get a bit messy, but better than nothing!
 	inline friend std::ostream& operator<<(std::ostream& o, const Matrix4& m){
 		o << "Mat4(";
@@ -162,5 +151,20 @@ public:
 		o << "\t\t" << m.values[3]<< "," << m.values[7]<< "," << m.values[11] << ","<< m.values [15] << " )" <<std::endl;
 		return o;
 	}
+
+protected:
+	//Returns the columns of the matrix weighted by x, y, z and w and added together, in
+	//the same order as a row of the matrix by a vector would be
+	inline __m128 Combine(float x, float y, float z, float w) const {
+		return Combine(_mm_loadu_ps(&values[0]), _mm_loadu_ps(&values[4]), _mm_loadu_ps(&values[8]), _mm_loadu_ps(&values[12]), x, y, z, w);
+	}
+
+	//Combine for columns that have already been loaded
+	static inline __m128 Combine(__m128 c0, __m128 c1, __m128 c2, __m128 c3, float x, float y, float z, float w) {
+		__m128 sum = _mm_mul_ps(c0, _mm_set1_ps(x));
+		sum = _mm_add_ps(sum, _mm_mul_ps(c1, _mm_set1_ps(y)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(c2, _mm_set1_ps(z)));
+		return _mm_add_ps(sum, _mm_mul_ps(c3, _mm_set1_ps(w)));
+	}
 };
 
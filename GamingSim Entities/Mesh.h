@@ -60,6 +60,10 @@ public:
 	//Gets the Mesh's diffuse map. Returns an OpenGL texture 'name'
 	GLuint  GetTexture()			{return texture;}
 
+	//Gets the corners of every triangle in the mesh, three at a time. Only kept
+	//for meshes the MeshManager was asked to keep the triangles of.
+	const vector<Vector3>& GetTriangles() const	{return triangles;}
+
 	GLuint	type;
 
 protected:
@@ -96,5 +100,8 @@ protected:
 	
 	//Number of indices for this mesh
 	GLuint			numIndices;
+
+	//A CPU side copy of the triangles, for meshes used as colliders
+	vector<Vector3>	triangles;
 };
 
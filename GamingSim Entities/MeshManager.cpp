@@ -21,12 +21,21 @@ Mesh* MeshManager::GetMesh(const string& filename){
 	return NULL;
 }
 
-Mesh* MeshManager::AddMesh(const string& filename){
+Mesh* MeshManager::AddMesh(const string& filename, bool keepTriangles){
 	//Check mesh hasnt already been added
 	Mesh* m = MeshManager::GetMesh(filename);
 
 	//If so just return a pointer to the mesh
 	if (m != NULL){
+		//If the mesh was loaded without its triangles, they are read from its file
+		//again. Only the triangles are kept, so nothing more goes to graphics memory.
+		if (keepTriangles && m->triangles.empty() && filename != "quad" && filename != "circle"){
+			vector<Vector2> uvs;
+			vector<Vector3> normals;
+
+			ReadObjFile((MESH_PATH + filename).c_str(), m->triangles, uvs, normals);
+		}
+
 		return m;
 	}
 
@@ -36,7 +45,7 @@ Mesh* MeshManager::AddMesh(const string& filename){
 		m = Mesh::GenerateCircle();
 	} else {
 		//Else load in the mesh
-		m = LoadObjFile((MESH_PATH + filename).c_str());
+		m = LoadObjFile((MESH_PATH + filename).c_str(), keepTriangles);
 	}
 
 	meshes.insert(std::pair<string, Mesh*>(filename, m));
@@ -45,18 +54,33 @@ Mesh* MeshManager::AddMesh(const string& filename){
 }
 
 
-Mesh* MeshManager::LoadObjFile(const char* filename){
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<Vector3> temp_vertices;
-	std::vector<Vector2> temp_uvs;
-	std::vector<Vector3> temp_normals;
-
+Mesh* MeshManager::LoadObjFile(const char* filename, bool keepTriangles){
 	std::vector<Vector3> out_vertices;
 	std::vector<Vector2> out_uvs;
 	std::vector<Vector3> out_normals;
 
+	if (!ReadObjFile(filename, out_vertices, out_uvs, out_normals)){
+		return NULL;
+	}
+
 	Mesh* m = new Mesh();
-	std::vector<Vector2> uvOut;
+
+	m->numVertices = out_vertices.size();
+	m->BufferData(out_vertices, out_uvs, out_normals);
+
+	//Colliders need the triangles once they are in graphics memory
+	if (keepTriangles){
+		m->triangles.swap(out_vertices);
+	}
+
+	return m;
+}
+
+bool MeshManager::ReadObjFile(const char* filename, vector<Vector3>& out_vertices, vector<Vector2>& out_uvs, vector<Vector3>& out_normals){
+	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
+	std::vector<Vector3> temp_vertices;
+	std::vector<Vector2> temp_uvs;
+	std::vector<Vector3> temp_normals;
 
 	FILE* file = fopen(filename, "r");
 
@@ -92,7 +116,8 @@ Mesh* MeshManager::LoadObjFile(const char* filename){
 
 			if (matches != 9){
 				printf("File can't be read by parser!");
-				return NULL;
+				fclose(file);
+				return false;
 			}
 
 			vertexIndices.push_back(vertexIndex[0]);
@@ -110,7 +135,7 @@ Mesh* MeshManager::LoadObjFile(const char* filename){
 
 	}
 
-	m->numVertices = vertexIndices.size();
+	fclose(file);
 
 	//For each vertex
 	for (unsigned int i =0; i<vertexIndices.size(); ++i){
@@ -140,7 +165,5 @@ Mesh* MeshManager::LoadObjFile(const char* filename){
 		out_normals.push_back(normal);
 	}
 
-	m->BufferData(out_vertices, out_uvs, out_normals);
-
-	return m;
-}
\ No newline at end of file
+	return true;
+}
@@ -19,11 +19,19 @@ class MeshManager :
 public:
 
 	Mesh* GetMesh(const string& filename);
-	Mesh* AddMesh(const string& filename);
+
+	//Adds a mesh. If keepTriangles is set, a copy of the mesh's triangles is kept
+	//on the CPU (see Mesh::GetTriangles), so the mesh can be used as a collider.
+	Mesh* AddMesh(const string& filename, bool keepTriangles = false);
 
 private:
 
-	Mesh* LoadObjFile(const char* filename);
+	Mesh* LoadObjFile(const char* filename, bool keepTriangles);
+
+	//Reads the corners, texture coordinates and normals of every triangle in an OBJ
+	//file into CPU memory, three at a time. Creates nothing in graphics memory.
+	//Returns false if the file cannot be read.
+	bool ReadObjFile(const char* filename, vector<Vector3>& vertices, vector<Vector2>& textureCoords, vector<Vector3>& normals);
 
 protected:
 	MeshManager(void){};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "ThreadPool.h"
+
+using std::vector;
+
+/**
+* Helpers for Morton (Z-order) codes. A code interleaves the bits of an x, y and z
+* cell coordinate so that cells that are close in space are close in the code, and
+* every octree cell covers one contiguous range of codes.
+*
+* The bits are interleaved in the same order octree children are numbered in
+* (x is the highest bit of each triple, then y, then z), so the lowest 3 bits of a
+* code are the node number of the cell within its parent.
+*/
+namespace Morton {
+	//The deepest level a 32 bit code can describe (3 bits per level)
+	static const int MAX_DEPTH = 10;
+
+	//Spreads the lowest 10 bits of x out so there are two zero bits between each
+	inline unsigned int SpreadBits(unsigned int x){
+		x &= 0x000003ff;
+		x = (x | (x << 16)) & 0x030000ff;
+		x = (x | (x << 8))  & 0x0300f00f;
+		x = (x | (x << 4))  & 0x030c30c3;
+		x = (x | (x << 2))  & 0x09249249;
+		return x;
+	}
+
+	//The inverse of SpreadBits, gathers every third bit back into the lowest 10 bits
+	inline unsigned int CompactBits(unsigned int x){
+		x &= 0x09249249;
+		x = (x | (x >> 2))  & 0x030c30c3;
+		x = (x | (x >> 4))  & 0x0300f00f;
+		x = (x | (x >> 8))  & 0x030000ff;
+		x = (x | (x >> 16)) & 0x000003ff;
+		return x;
+	}
+
+	//Returns the code of the cell at the supplied coordinates
+	inline unsigned int Encode(unsigned int x, unsigned int y, unsigned int z){
+		return (SpreadBits(x) << 2) | (SpreadBits(y) << 1) | SpreadBits(z);
+	}
+
+	//Retrieves the cell coordinates of a code
+	inline void Decode(unsigned int code, unsigned int& x, unsigned int& y, unsigned int& z){
+		x = CompactBits(code >> 2);
+		y = CompactBits(code >> 1);
+		z = CompactBits(code);
+	}
+
+	//A code, and the index of whatever it is the code of
+	struct Key {
+		unsigned int code;
+		int index;
+	};
+
+	//Sorts keys by the lowest bits of their codes, 8 bits at a time, keeping keys with
+	//equal codes in their original order. Each worker counts and then scatters its own
+	//block of the keys. The scratch list is used as the second buffer of every pass.
+	inline void RadixSort(vector<Key>& keys, vector<Key>& scratch, int bits, ThreadPool* workers = NULL){
+		int n = keys.size();
+		scratch.resize(n);
+
+		//Not worth splitting small sorts between workers
+		int blocks = workers != NULL ? workers->GetWorkerCount() : 1;
+		if (blocks > n / 4096) blocks = n / 4096;
+		if (blocks < 1) blocks = 1;
+
+		//The number of keys with each digit in each block, then where the block
+		//writes its next key with each digit. A single block needs no heap memory.
+		int single[256];
+		vector<int> many;
+		int* offsets = single;
+
+		if (blocks > 1){
+			many.resize(blocks * 256);
+			offsets = &many[0];
+		}
+
+		for (int shift = 0; shift < bits; shift += 8){
+			std::fill(offsets, offsets + blocks * 256, 0);
+
+			auto count = [&](int begin, int end, int worker){
+				for (int b = begin; b < end; ++b){
+					int* o = &offsets[b * 256];
+
+					for (int i = n * b / blocks; i < n * (b + 1) / blocks; ++i){
+						o[(keys[i].code >> shift) & 0xff]++;
+					}
+				}
+			};
+
+			auto scatter = [&](int begin, int end, int worker){
+				for (int b = begin; b < end; ++b){
+					int* o = &offsets[b * 256];
+
+					for (int i = n * b / blocks; i < n * (b + 1) / blocks; ++i){
+						scratch[o[(keys[i].code >> shift) & 0xff]++] = keys[i];
+					}
+				}
+			};
+
+			if (blocks > 1) workers->ParallelFor(blocks, count);
+			else count(0, blocks, 0);
+
+			//Keys with lower digits come first, and within a digit, keys from lower blocks
+			int start = 0;
+			for (int d = 0; d < 256; ++d){
+				for (int b = 0; b < blocks; ++b){
+					int c = offsets[b * 256 + d];
+					offsets[b * 256 + d] = start;
+					start += c;
+				}
+			}
+
+			if (blocks > 1) workers->ParallelFor(blocks, scatter);
+			else scatter(0, blocks, 0);
+
+			keys.swap(scratch);
+		}
+	}
+}
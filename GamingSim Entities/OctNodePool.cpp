@@ -0,0 +1,60 @@
+#include "OctNodePool.h"
+
+OctNodePool::OctNodePool(int blocksPerChunk)
+{
+	//A chunk must hold at least one block
+	this->blocksPerChunk = blocksPerChunk > 0 ? blocksPerChunk : 1;
+	blocksInUse = 0;
+	freeBlocks = NULL;
+}
+
+OctNodePool::~OctNodePool(void)
+{
+	//Deleting each chunk frees every node it holds. The spheres in them belong to the
+	//physics engine, which deletes them itself.
+	while (!chunks.empty()){
+		delete [] chunks.back();
+		chunks.pop_back();
+	}
+}
+
+OctNode* OctNodePool::AllocateBlock(){
+	//Only go to the heap when there are no recycled blocks left
+	if (freeBlocks == NULL){
+		Grow();
+	}
+
+	//Pop the block from the head of the free list
+	OctNode* block = freeBlocks;
+	freeBlocks = block[0].children;
+
+	for (int i=0; i<8; ++i){
+		block[i].children = NULL;
+		block[i].sweep.clear();
+		block[i].sweepAxis = 0;
+	}
+
+	blocksInUse++;
+
+	return block;
+}
+
+void OctNodePool::ReleaseBlock(OctNode* block){
+	//Push the block onto the head of the free list
+	block[0].children = freeBlocks;
+	freeBlocks = block;
+
+	blocksInUse--;
+}
+
+void OctNodePool::Grow(){
+	OctNode* chunk = new OctNode[8 * blocksPerChunk];
+	chunks.push_back(chunk);
+
+	//Thread each block of 8 onto the free list
+	for (int i=0; i<blocksPerChunk; ++i){
+		OctNode* block = chunk + (8 * i);
+		block[0].children = freeBlocks;
+		freeBlocks = block;
+	}
+}
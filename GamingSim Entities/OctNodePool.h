@@ -0,0 +1,105 @@
+#pragma once
+
+#include <list>
+#include <vector>
+#include "Sphere.h"
+#include "PlaneSet.h"
+
+using std::list;
+using std::vector;
+
+//A sphere in the sweep of a crowded leaf, with its extent along the leaf's sweep axis
+struct SweepEntry {
+	float low;
+	float high;
+	Sphere* sphere;
+};
+
+//An "OctNode" represents one node in an octree
+struct OctNode {
+	//A pointer to the parent of each node
+	OctNode* parent;
+
+	//A pointer to a block of 8 children, allocated as a single unit from the
+	//node pool. NULL if this node is a leaf (has spheres for children).
+	OctNode* children;
+
+	//The number of parents this node has. The root node has a depth of 0.
+	int depth;
+
+	//The number of spheres stored in the leaves beneath (or in) this node. Spheres
+	//stored in several leaves are counted once per leaf.
+	int count;
+
+	//How many of those spheres are awake. Subtrees without an awake sphere have
+	//no collisions to find.
+	int awake;
+
+	//The planes a sphere centered in this node's bounds (its loose bounds in a loose
+	//octree) may be colliding with. Always a subset of its parent's planes.
+	PlaneMask planes;
+
+	//Size is always a positive vector that represents the height, width and depth of the node
+	Vector3 size;
+
+	//Position always denotes the lowest x, y and z coords of the node. Its highest points are
+	//position + size
+	Vector3 pos;
+
+	//We store the spheres if this node contains a number of spheres below the threshold.
+	//They are kept contiguous, as they are always checked sequentially, and the memory
+	//is kept when the node is emptied or handed back to the pool, so a node that has
+	//held spheres before can be filled again without allocating.
+	vector<Sphere*> spheres;
+
+	//The spheres of a crowded leaf, sorted along the axis they are spread furthest
+	//along. Kept from frame to frame, as the order barely changes, and emptied
+	//whenever a sphere is added to or removed from the leaf.
+	vector<SweepEntry> sweep;
+	int sweepAxis;
+};
+
+/**
+* A pool that hands out blocks of 8 OctNodes. Blocks are carved out of larger
+* chunks, and released blocks are kept on a free list to be handed straight back
+* out, so splitting and collapsing nodes does not touch the heap once the pool
+* has grown to the size of the tree.
+*/
+class OctNodePool
+{
+public:
+	OctNodePool(int blocksPerChunk = 64);
+	~OctNodePool(void);
+
+	//Returns a block of 8 nodes. The nodes never hold any spheres.
+	OctNode* AllocateBlock();
+
+	//Returns a block of 8 nodes to the free list. The nodes must not have
+	//children of their own.
+	void ReleaseBlock(OctNode* block);
+
+	//The number of chunks allocated from the heap over the life of the pool
+	inline int GetChunkCount() const { return chunks.size(); }
+
+	//The number of blocks currently handed out by the pool
+	inline int GetBlocksInUse() const { return blocksInUse; }
+
+protected:
+	//Allocates a new chunk from the heap and threads its blocks onto the free list.
+	void Grow();
+
+	int blocksPerChunk;
+	int blocksInUse;
+
+	//The head of the free list. Free blocks are linked through the children
+	//pointer of their first node.
+	OctNode* freeBlocks;
+
+	//Every chunk of nodes allocated by this pool, deleted on destruction
+	list<OctNode*> chunks;
+
+private:
+	//Pools cannot be copied, as they own their chunks
+	OctNodePool(const OctNodePool&);
+	OctNodePool& operator=(const OctNodePool&);
+};
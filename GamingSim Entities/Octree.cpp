@@ -1,9 +1,8 @@
 #include "Octree.h"
-#include <bitset>
+#include <algorithm>
+#include <emmintrin.h>
 
-using std::bitset;
-
-Octree::Octree(Vector3 size, int threshold, int maxDepth)
+Octree::Octree(Vector3 size, int threshold, int maxDepth, ThreadPool* workers, float looseness)
 {
 	//Set the root size to the size supplied
 	root.size = size;
@@ -13,6 +12,16 @@ Octree::Octree(Vector3 size, int threshold, int maxDepth)
 
 	//This is the root node, it has no parent
 	root.parent = NULL;
+	root.children = NULL;
+	root.depth = 0;
+	root.count = 0;
+	root.awake = 0;
+	root.planes = 0;
+	root.sweepAxis = 0;
+
+	//There are no planes until they are set
+	planes = NULL;
+	planeRadius = 0.0f;
 
 	//Create some initial nodes for the root node.
 	CreateNodes(root);
@@ -20,15 +29,25 @@ Octree::Octree(Vector3 size, int threshold, int maxDepth)
 	//Set the octree properties
 	this->threshold = threshold;
 	this->maxDepth = maxDepth;
+	this->workers = workers;
+
+	//A loose node can not be smaller than the node itself
+	if (looseness > 0.0f && looseness < 1.0f) looseness = 1.0f;
+	this->looseness = looseness;
+
+	//Spheres are stored by their exact bounds until a margin is set
+	velocityScale = 0.0f;
+	padding = 0.0f;
+	reinsertions = 0;
 
 	//Create the render object used for rendering an octree node
 	cube = new RenderObject(MeshManager::Instance().GetMesh("cube.obj"), ShaderManager::Instance().GetShader("basic"), TextureManager::Instance().GetTexture("yellow.png"));
 }
 
 
-OctNode* Octree::CreateNode(int nodeNumber, OctNode& parent){
-	//Create each node
-	OctNode* o = new OctNode();
+void Octree::CreateNode(int nodeNumber, OctNode& parent){
+	//Each node lives in its parent's block of children
+	OctNode* o = &parent.children[nodeNumber];
 
 	//Set the size property for each node, (slight calc overhead here...)
 	o->size = parent.size * 0.5;
@@ -47,180 +66,795 @@ OctNode* Octree::CreateNode(int nodeNumber, OctNode& parent){
 	111
 	*/
 	Vector3 position = parent.pos;
-	bitset<32> b(nodeNumber);
 
-	if (b.test(0)){
+	if (nodeNumber & 1){
 		//First bit (starting from the left) is on,
 		//set Z correctly!
 		position.z = (parent.pos.z + o->size.z );
 	}
 
-	if (b.test(1)){
+	if (nodeNumber & 2){
 		//Second bit is on, set Y correctly
 		position.y = (parent.pos.y + o->size.y );
 	}
 
-	if (b.test(2)){
+	if (nodeNumber & 4){
 		//Third bit is on, set X correctly
 		position.x = (parent.pos.x + o->size.x );
 	}
 
 	o->pos = position;
 	o->parent = &parent;
+	o->depth = parent.depth + 1;
+	o->count = 0;
+	o->awake = 0;
 
-	return o;
+	//A child can only be cut by the planes that cut its parent
+	ClassifyNode(*o, parent.planes);
 }
 
 void Octree::CreateNodes(OctNode& node){
+	//All 8 children are allocated as a single block
+	{
+		std::lock_guard<std::mutex> l(poolLock);
+		node.children = pool.AllocateBlock();
+	}
+
 	//The size of the nodes should be 1/8th of the size of the parent.
 	//(Vec3 / 2 = 1/8th size)
 	for (int i=0; i<8; ++i){
-		node.nodes.push_back(CreateNode(i, node));
+		CreateNode(i, node);
 	}
 };
 
+void Octree::ClassifyNode(OctNode& node, PlaneMask candidates){
+	if (planes == NULL || candidates == 0){
+		node.planes = 0;
+		return;
+	}
+
+	Vector3 low = node.pos;
+	Vector3 high = node.pos + node.size;
+
+	//Spheres in a loose octree are centered anywhere in a node's loose bounds
+	if (looseness > 0.0f){
+		float m = (looseness - 1.0f) * 0.5f;
+		low = low - node.size * m;
+		high = high + node.size * m;
+	}
+
+	node.planes = planes->Classify(low, high, planeRadius, candidates);
+}
+
+void Octree::ClassifyTree(OctNode& node, PlaneMask candidates){
+	ClassifyNode(node, candidates);
+
+	if (node.children != NULL){
+		for (int i=0; i<8; ++i){
+			ClassifyTree(node.children[i], node.planes);
+		}
+	}
+}
+
+void Octree::CoverRadius(const Sphere& e){
+	if (e.radius <= planeRadius) return;
+
+	//Leave some room, so spheres growing a little at a time do not each cause
+	//the whole tree to be classified again
+	planeRadius = e.radius * 1.25f;
+
+	if (planes != NULL){
+		ClassifyTree(root, ALL_PLANES);
+	}
+}
+
+void Octree::SetPlanes(const PlaneSet& planes){
+	this->planes = &planes;
+	ClassifyTree(root, ALL_PLANES);
+}
+
+PlaneMask Octree::NearbyPlanes(const Sphere& e) const{
+	if (planes == NULL) return ALL_PLANES;
+
+	//A sphere inside its fat bounds is centered in one of the nodes it is stored in,
+	//as long as it is still inside the world
+	if (e.leaves.empty() || !InFatBounds(e)) return ALL_PLANES;
+
+	Vector3 p = e.getPos();
+
+	if (p.x < root.pos.x || p.x > root.pos.x + root.size.x ||
+		p.y < root.pos.y || p.y > root.pos.y + root.size.y ||
+		p.z < root.pos.z || p.z > root.pos.z + root.size.z){
+		return ALL_PLANES;
+	}
+
+	PlaneMask nearby = 0;
+
+	for (unsigned int i=0; i<e.leaves.size(); ++i){
+		nearby |= e.leaves[i].leaf->planes;
+	}
+
+	return nearby;
+}
+
 bool Octree::AddSphere(Sphere& e){
 	//Recursively look where the Sphere should go, by looking at each node.
+	SetFatBounds(e);
+	CoverRadius(e);
+	e.countedAwake = e.getAwake();
 	return InsertSphere(root, e);
 }
 
-bool Octree::InsertSphere(OctNode& node, Sphere& e){
-	//Check to see if the Sphere is within the node size, performing a
-	//bounding box check
+int Octree::AddSpheres(vector<Sphere*>& batch){
+	//Only an empty tree can be built in one go, and only to a depth a Morton code can describe
+	if (root.count != 0 || maxDepth > Morton::MAX_DEPTH){
+		return BroadPhase::AddSpheres(batch);
+	}
 
-	//Check X axis
-	if (e.getPos().x + e.getRadius() < node.pos.x){
-		//The highest point of the sphere is lower than the lowest X. FAIL.
-		return false;
+	//Move any sphere outside the world to the end of the batch
+	int added = 0;
+
+	for (unsigned int i=0; i<batch.size(); ++i){
+		Sphere& e = *batch[i];
+		SetFatBounds(e);
+		CoverRadius(e);
+		e.countedAwake = e.getAwake();
+
+		if (looseness > 0.0f ? Overlaps(root, e) : Touches(root, e)){
+			std::swap(batch[added++], batch[i]);
+		}
 	}
-	if (e.getPos().x - e.getRadius() > (node.pos + node.size).x) {
-		//The lowest point of the sphere is higher than the highest X. FAIL
-		return false;
+
+	Build(batch, added);
+
+	return added;
+}
+
+void Octree::Build(vector<Sphere*>& batch, int count){
+	//Throw away the empty nodes the tree already has
+	if (root.children != NULL){
+		CollapseNode(root);
 	}
 
-	//Check Y axis
-	if (e.getPos().y + e.getRadius() < node.pos.y){
-		return false;
+	//Find the code of the cell at the deepest level that each sphere is centered in
+	vector<Morton::Key> keys(count);
+	vector<Morton::Key> scratch;
+	int cells = 1 << maxDepth;
+
+	ThreadPool::Job encode = [&](int begin, int end, int worker){
+		for (int i = begin; i < end; ++i){
+			Vector3 p = batch[i]->fatPos;
+
+			keys[i].code = Morton::Encode(Cell(p.x, root.pos.x, root.size.x, cells),
+				Cell(p.y, root.pos.y, root.size.y, cells),
+				Cell(p.z, root.pos.z, root.size.z, cells));
+			keys[i].index = i;
+		}
+	};
+
+	if (workers != NULL) workers->ParallelFor(count, encode);
+	else encode(0, count, 0);
+
+	Morton::RadixSort(keys, scratch, maxDepth * 3, workers);
+
+	building.resize(count);
+	codes.resize(count);
+	placed.assign(count, 0);
+
+	for (int i=0; i<count; ++i){
+		building[i] = batch[keys[i].index];
+		codes[i] = keys[i].code;
 	}
-	if (e.getPos().y - e.getRadius() > (node.pos + node.size).y) {
-		return false;
+
+	//Hand out several subtrees per worker, so they can balance the load between them
+	vector<BuildTask> tasks;
+	taskDepth = 0;
+
+	if (workers != NULL && workers->GetWorkerCount() > 1){
+		for (int n = 1; n < workers->GetWorkerCount() * 4 && taskDepth < maxDepth; n *= 8){
+			taskDepth++;
+		}
 	}
 
-	//Check Z axis
-	if (e.getPos().z + e.getRadius() < node.pos.z){
-		return false;
+	vector<BuildTask>* deferred = taskDepth > 0 ? &tasks : NULL;
+
+	if (looseness > 0.0f){
+		BuildLooseNode(root, 0, count, count, deferred);
+	} else {
+		vector<int> extras;
+		BuildNode(root, 0, count, extras, deferred);
 	}
-	if (e.getPos().z - e.getRadius() > (node.pos + node.size).z) {
-		return false;
+
+	ThreadPool::Job build = [&](int begin, int end, int worker){
+		for (int i = begin; i < end; ++i){
+			BuildTask& t = tasks[i];
+
+			if (looseness > 0.0f){
+				BuildLooseNode(*t.node, t.begin, t.end, t.count, NULL);
+			} else {
+				BuildNode(*t.node, t.begin, t.end, t.extras, NULL);
+			}
+		}
+	};
+
+	if (!tasks.empty()){
+		workers->ParallelFor(tasks.size(), build);
+	}
+
+	Link(root);
+
+	//Free the memory only needed to build the tree
+	vector<Sphere*>().swap(building);
+	vector<unsigned int>().swap(codes);
+	vector<char>().swap(placed);
+}
+
+void Octree::BuildNode(OctNode& node, int begin, int end, vector<int>& extras, vector<BuildTask>* tasks){
+	//Leave the rest of the subtree for a worker to build
+	if (tasks != NULL && node.depth == taskDepth){
+		tasks->push_back(BuildTask());
+		BuildTask& t = tasks->back();
+		t.node = &node;
+		t.begin = begin;
+		t.end = end;
+		t.count = 0;
+		t.extras.swap(extras);
+		return;
 	}
 
-	//Bounding box succeeded, do a more accurate check
-	//The distance between the center of the sphere and the center of the 
-	//node must be less than the radius of the sphere + the diagonal distance
-	//from the center of the square to the edge (basically pretending the box 
-	// is a sphere.
-	if (e.getPos().GetDistance(node.pos + (node.size * 0.5)) > (e.getRadius() + node.pos.GetDistance(node.pos + (node.size *0.5)))){
+	//As with InsertSphere, the node only splits once more spheres than the threshold touch it
+	int count = end - begin + extras.size();
+
+	if (count <= threshold || node.depth >= maxDepth){
+		for (int i = begin; i < end; ++i){
+			if (Touches(node, *building[i])){
+				node.spheres.push_back(building[i]);
+			}
+		}
+
+		for (unsigned int i=0; i<extras.size(); ++i){
+			node.spheres.push_back(building[extras[i]]);
+		}
+
+		return;
+	}
+
+	CreateNodes(node);
+
+	//The spheres that may touch more than one child. Those from outside the node,
+	//and those that cross one of the planes through its center.
+	Vector3 center = node.pos + (node.size * 0.5f);
+	vector<int> straddling(extras);
+
+	for (int i = begin; i < end; ++i){
+		Vector3 p = building[i]->fatPos;
+		float r = building[i]->fatRadius;
+
+		if ((p.x - r <= center.x && p.x + r >= center.x) ||
+			(p.y - r <= center.y && p.y + r >= center.y) ||
+			(p.z - r <= center.z && p.z + r >= center.z)){
+			straddling.push_back(i);
+		}
+	}
+
+	//Each child holds the spheres whose codes have its node number at its depth
+	int shift = (maxDepth - node.depth - 1) * 3;
+	int first = begin;
+
+	for (int c=0; c<8; ++c){
+		int last = first;
+
+		while (last < end && static_cast<int>((codes[last] >> shift) & 7) == c){
+			last++;
+		}
+
+		vector<int> childExtras;
+
+		for (unsigned int i=0; i<straddling.size(); ++i){
+			int j = straddling[i];
+
+			if ((j < first || j >= last) && Touches(node.children[c], *building[j])){
+				childExtras.push_back(j);
+			}
+		}
+
+		BuildNode(node.children[c], first, last, childExtras, tasks);
+		first = last;
+	}
+}
+
+void Octree::BuildLooseNode(OctNode& node, int begin, int end, int count, vector<BuildTask>* tasks){
+	//Leave the rest of the subtree for a worker to build
+	if (tasks != NULL && node.depth == taskDepth){
+		tasks->push_back(BuildTask());
+		BuildTask& t = tasks->back();
+		t.node = &node;
+		t.begin = begin;
+		t.end = end;
+		t.count = count;
+		return;
+	}
+
+	//As with InsertLoose, the node only splits once it holds more spheres than the threshold
+	if (count <= threshold || node.depth >= maxDepth){
+		for (int i = begin; i < end; ++i){
+			if (!placed[i]){
+				node.spheres.push_back(building[i]);
+			}
+		}
+
+		return;
+	}
+
+	CreateNodes(node);
+
+	//Spheres that do not fit inside the loose bounds of their child stay in this node
+	int shift = (maxDepth - node.depth - 1) * 3;
+	int childCount[8] = { 0 };
+
+	for (int i = begin; i < end; ++i){
+		if (placed[i]) continue;
+
+		int c = (codes[i] >> shift) & 7;
+
+		if (Fits(node.children[c], *building[i])){
+			childCount[c]++;
+		} else {
+			node.spheres.push_back(building[i]);
+			placed[i] = 1;
+		}
+	}
+
+	int first = begin;
+
+	for (int c=0; c<8; ++c){
+		int last = first;
+
+		while (last < end && static_cast<int>((codes[last] >> shift) & 7) == c){
+			last++;
+		}
+
+		BuildLooseNode(node.children[c], first, last, childCount[c], tasks);
+		first = last;
+	}
+}
+
+void Octree::Link(OctNode& node){
+	node.count = node.spheres.size();
+	node.awake = 0;
+
+	//Record where each sphere in the node is stored
+	for (unsigned int i=0; i<node.spheres.size(); ++i){
+		LeafEntry entry;
+		entry.leaf = &node;
+		entry.index = i;
+		node.spheres[i]->leaves.push_back(entry);
+
+		if (node.spheres[i]->countedAwake) node.awake++;
+	}
+
+	if (node.children != NULL){
+		for (int i=0; i<8; ++i){
+			Link(node.children[i]);
+			node.count += node.children[i].count;
+			node.awake += node.children[i].awake;
+		}
+	}
+}
+
+void Octree::RemoveSphere(Sphere& e){
+	//Take the sphere out of its leaves, and collapse any nodes it leaves too empty
+	RemoveFromLeaves(e);
+	CollapseCandidates();
+
+	contacts.Remove(e);
+}
+
+bool Octree::InsertSphere(OctNode& node, Sphere& e){
+	//Loose octrees store each sphere in a single node
+	if (looseness > 0.0f){
+		return InsertLoose(node, e);
+	}
+
+	//Check to see if the Sphere is within the node size
+	if (!Touches(node, e)){
 		return false;
 	}
 
-	//If it is check to see whether the node has nodes for children, or
-	//spheres. If nodes then, try insert the Sphere into each of the children
-	if (node.nodes.size() != 0){
+	InsertTouching(node, e);
 
-		//Iterate through all nodes, attempt insertion
-		for (std::list<OctNode*>::const_iterator i = node.nodes.begin(); i != node.nodes.end(); ++i){
-			InsertSphere(**i, e);
+	//If false hasnt been returned yet, insert must have succeeeded
+	return true;
+}
+
+void Octree::InsertTouching(OctNode& node, Sphere& e){
+	//Check to see whether the node has nodes for children, or spheres. If nodes
+	//then, insert the Sphere into each of the children it touches, all 8 of which
+	//are tested at once
+	if (node.children != NULL){
+		int touched = TouchedChildren(node, e);
+
+		for (int i=0; i<8; ++i){
+			if (touched & (1 << i)){
+				InsertTouching(node.children[i], e);
+			}
 		}
 
-	} else if (node.spheres.size() == threshold && NumberOfParents(node) < maxDepth){
+	} else if (node.spheres.size() == threshold && node.depth < maxDepth){
 		//Else check if the current node has reached the threshold, if so
 		//make this node's children become nodes, and loop through the spheres
 		//to sort them into the new nodes.
 		CreateNodes(node);
-		node.spheres.push_back(&e);
 
-		while (!node.spheres.empty()){
-			if (!InsertSphere(node, *node.spheres.back())) std::cout << "Fail";
-			node.spheres.pop_back();
+		vector<Sphere*> moved;
+		moved.swap(node.spheres);
+
+		for (unsigned int i=0; i<moved.size(); ++i){
+			Sphere& s = *moved[i];
+
+			//This node no longer stores the sphere...
+			for (unsigned int j=0; j<s.leaves.size(); ++j){
+				if (s.leaves[j].leaf == &node){
+					s.leaves[j] = s.leaves.back();
+					s.leaves.pop_back();
+					break;
+				}
+			}
+
+			Recount(&node, -1, s.countedAwake ? -1 : 0);
+
+			//...its new children do. A sphere that has moved out of the node since it
+			//was stored is left without leaves, and is relocated later in the update.
+			InsertSphere(node, s);
 		}
+
+		InsertTouching(node, e);
 	} else {
 		//The node has spheres for children, and has not reached the threshold.
 		//Insert this sphere into this node.
-		node.spheres.push_back(&e);
+		AddToLeaf(node, e);
 	}
+}
 
-	//If false hasnt been returned yet, insert must have succeeeded
-	return true;
+bool Octree::Touches(const OctNode& node, const Sphere& e) const{
+	//The distance along each axis from the center of the sphere to the nearest point
+	//of the node, which is 0 along the axes the center is within the node on. Worked
+	//out exactly as TouchedChildren does, so the two always agree.
+	Vector3 p = e.fatPos;
+	Vector3 high = node.pos + node.size;
+
+	float dx = max(node.pos.x - p.x, 0.0f) + max(p.x - high.x, 0.0f);
+	float dy = max(node.pos.y - p.y, 0.0f) + max(p.y - high.y, 0.0f);
+	float dz = max(node.pos.z - p.z, 0.0f) + max(p.z - high.z, 0.0f);
+
+	return (dx * dx) + (dy * dy) + (dz * dz) <= e.fatRadius * e.fatRadius;
+}
+
+int Octree::TouchedChildren(const OctNode& node, const Sphere& e) const{
+	const __m128 zero = _mm_setzero_ps();
+	Vector3 half = node.size * 0.5;
+
+	__m128 py = _mm_set1_ps(e.fatPos.y);
+	__m128 pz = _mm_set1_ps(e.fatPos.z);
+	__m128 r2 = _mm_set1_ps(e.fatRadius * e.fatRadius);
+
+	//The low corners of the children, as CreateNode places them. Bit 0 of a child's
+	//index is its half along z, bit 1 along y and bit 2 along x, so the children
+	//are tested in two groups of 4 which only differ along x.
+	float y0 = node.pos.y, y1 = node.pos.y + half.y;
+	float z0 = node.pos.z, z1 = node.pos.z + half.z;
+
+	__m128 lowY = _mm_setr_ps(y0, y0, y1, y1);
+	__m128 lowZ = _mm_setr_ps(z0, z1, z0, z1);
+
+	//The distance from the center to each child along y and z is shared by both groups
+	__m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(lowY, py), zero),
+		_mm_max_ps(_mm_sub_ps(py, _mm_add_ps(lowY, _mm_set1_ps(half.y))), zero));
+	__m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(lowZ, pz), zero),
+		_mm_max_ps(_mm_sub_ps(pz, _mm_add_ps(lowZ, _mm_set1_ps(half.z))), zero));
+
+	int touched = 0;
+
+	for (int g = 0; g < 2; ++g){
+		float lowX = g == 0 ? node.pos.x : node.pos.x + half.x;
+		float dx = max(lowX - e.fatPos.x, 0.0f) + max(e.fatPos.x - (lowX + half.x), 0.0f);
+
+		__m128 x2 = _mm_set1_ps(dx * dx);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(x2, _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		touched |= _mm_movemask_ps(_mm_cmple_ps(d2, r2)) << (g * 4);
+	}
+
+	return touched;
+}
+
+void Octree::AddToLeaf(OctNode& leaf, Sphere& e){
+	leaf.spheres.push_back(&e);
+	leaf.sweep.clear();
+
+	//Record where the sphere is stored, so it can be removed without a search
+	LeafEntry entry;
+	entry.leaf = &leaf;
+	entry.index = leaf.spheres.size() - 1;
+	e.leaves.push_back(entry);
+
+	//The leaf and every node above it hold one more sphere
+	Recount(&leaf, 1, e.countedAwake ? 1 : 0);
+}
+
+void Octree::TakeFromLeaf(OctNode& leaf, int index){
+	Sphere* last = leaf.spheres.back();
+	leaf.spheres.pop_back();
+	leaf.sweep.clear();
+
+	//The sphere taken out was the last one, so nothing moves
+	if (index == static_cast<int>(leaf.spheres.size())) return;
+
+	leaf.spheres[index] = last;
+
+	for (unsigned int i=0; i<last->leaves.size(); ++i){
+		if (last->leaves[i].leaf == &leaf){
+			last->leaves[i].index = index;
+			break;
+		}
+	}
+}
+
+void Octree::RemoveFromLeaves(Sphere& e){
+	for (unsigned int i=0; i<e.leaves.size(); ++i){
+		OctNode* leaf = e.leaves[i].leaf;
+		TakeFromLeaf(*leaf, e.leaves[i].index);
+
+		//The leaf and every node above it hold one less sphere
+		Recount(leaf, -1, e.countedAwake ? -1 : 0);
+
+		//Which may have left the leaf's parent below the threshold. In a loose
+		//octree the sphere may have been stored in a node with children, which may
+		//have fallen below the threshold itself.
+		if (leaf->children != NULL){
+			collapseCandidates.push_back(leaf);
+		} else if (leaf->parent != NULL){
+			collapseCandidates.push_back(leaf->parent);
+		}
+	}
+
+	e.leaves.clear();
 }
 
 //Collapses a node that contains nodes for children, and assigns all
 //those children nodes spheres to this node.
 void Octree::CollapseNode(OctNode& node){
-	set<Sphere*> toBeMoved;
-
 	//For every node in this node
-	for (std::list<OctNode*>::const_iterator i = node.nodes.begin(); i != node.nodes.end(); ++i){
-		//while each nodes spheres are not empty.
-		while ( !(*i)->spheres.empty() ){
-			//Add each sphere to a set (sets only allow unique elements)
-			toBeMoved.insert((*i)->spheres.back());
-			(*i)->spheres.pop_back();
+	for (int i=0; i<8; ++i){
+		OctNode& child = node.children[i];
+
+		//Any children with children of their own are collapsed first
+		if (child.children != NULL){
+			CollapseNode(child);
 		}
+
+		//Move each sphere from the child up to this node
+		for (unsigned int j=0; j<child.spheres.size(); ++j){
+			Sphere& s = *child.spheres[j];
+			bool stored = false;
+
+			//Spheres that straddle the children are only stored in this node once
+			for (unsigned int k=0; k<s.leaves.size(); ){
+				if (s.leaves[k].leaf == &child){
+					s.leaves[k] = s.leaves.back();
+					s.leaves.pop_back();
+				} else {
+					stored = stored || s.leaves[k].leaf == &node;
+					k++;
+				}
+			}
+
+			if (!stored){
+				node.spheres.push_back(&s);
+
+				LeafEntry entry;
+				entry.leaf = &node;
+				entry.index = node.spheres.size() - 1;
+				s.leaves.push_back(entry);
+			}
+		}
+
+		child.spheres.clear();
+		child.sweep.clear();
 	}
 
-	//Then push the set into this node. This node has now been collapsed.
-	for (set<Sphere*>::const_iterator i = toBeMoved.begin(); i != toBeMoved.end(); ++i){
-		node.spheres.push_back(*i);
+	node.sweep.clear();
+
+	//This node and those above it no longer count the duplicates
+	int awake = 0;
+
+	for (unsigned int i=0; i<node.spheres.size(); ++i){
+		if (node.spheres[i]->countedAwake) awake++;
 	}
 
-	//Then remove the old node children
-	while (!(node.nodes.empty())){
-		//Delete each node
-		delete node.nodes.back();
+	Recount(&node, node.spheres.size() - node.count, awake - node.awake);
 
-		//Then remove them
-		node.nodes.pop_back();
+	//Then hand the old block of children back to the pool
+	pool.ReleaseBlock(node.children);
+	node.children = NULL;
+}
+
+void Octree::CollapseCandidates(){
+	while (!collapseCandidates.empty()){
+		//Always take the deepest candidate. A collapse releases the nodes beneath it,
+		//so every candidate beneath it must have been dealt with first.
+		unsigned int deepest = 0;
+
+		for (unsigned int i=1; i<collapseCandidates.size(); ++i){
+			if (collapseCandidates[i]->depth > collapseCandidates[deepest]->depth){
+				deepest = i;
+			}
+		}
+
+		OctNode* node = collapseCandidates[deepest];
+		collapseCandidates[deepest] = collapseCandidates.back();
+		collapseCandidates.pop_back();
+
+		//Check to see if the node is below the threshold, if so collapse the node.
+		//(It may already have been collapsed if it was a candidate more than once)
+		if (node->children != NULL && node->count < threshold){
+			CollapseNode(*node);
+
+			//Which may take its parent below the threshold too
+			if (node->parent != NULL){
+				collapseCandidates.push_back(node->parent);
+			}
+		}
 	}
 }
 
-int Octree::RemoveAwake(OctNode& node, set<Sphere*>& removed){
+void Octree::Relocate(Sphere& e){
+	//A sphere that has grown may be larger than the nodes were classified for
+	CoverRadius(e);
 
-	//If the node supplied has spheres as children...
-	if (node.spheres.size() != 0){
+	//The tree is still correct while a sphere stays inside its fat bounds
+	if (!e.leaves.empty() && InFatBounds(e)){
+		return;
+	}
 
-		//...scan through to remove awake ones.
-		for (list<Sphere*>::iterator i = node.spheres.begin(); i != node.spheres.end();){
-			if ( (*i)->getAwake() ){
+	SetFatBounds(e);
 
-				//Add them to a set of removed spheres
-				removed.insert(*i);
+	//A sphere stored in a single leaf that still contains it has not gone anywhere
+	if (looseness > 0.0f){
+		if (e.leaves.size() == 1 && Settled(*e.leaves[0].leaf, e)){
+			return;
+		}
+	} else if (e.leaves.size() == 1 && Contains(*e.leaves[0].leaf, e)){
+		return;
+	}
+
+	//Remember the path from one of the sphere's leaves up to the root
+	path.clear();
 
-				//Then remove from node
-				node.spheres.erase(i++);
-			} else { i++; }
+	if (!e.leaves.empty()){
+		for (OctNode* n = e.leaves[0].leaf; n != NULL; n = n->parent){
+			path.push_back(n);
 		}
+	} else {
+		//The sphere was outside of the world, so has no leaves
+		path.push_back(&root);
+	}
+
+	reinsertions++;
+
+	RemoveFromLeaves(e);
+	CollapseCandidates();
+
+	//Collapsing may have released the bottom of the path. Walking down from the
+	//root, the first node without children is the leaf that now covers it.
+	int i = path.size() - 1;
+
+	while (i > 0 && path[i]->children != NULL){
+		i--;
+	}
 
-		return node.spheres.size();
+	//Climb to the nearest node that entirely contains the sphere, and insert from there
+	OctNode* start = path[i];
+
+	while (start->parent != NULL && !(looseness > 0.0f ? Fits(*start, e) : Contains(*start, e))){
+		start = start->parent;
+	}
+
+	InsertSphere(*start, e);
+}
+
+bool Octree::InsertLoose(OctNode& node, Sphere& e){
+	//Only the root can refuse a sphere, if the sphere lies outside the world
+	if (&node == &root && !Overlaps(root, e)){
+		return false;
 	}
-	//If the node supplied has nodes for children...
-	else {
-		//Create variable to store the number of spheres in this nodes children.
-		int x = 0;
 
-		//Remove all awake nodes from this nodes children, and count the number of spheres
-		//the children have
-		for (list<OctNode*>::iterator i = node.nodes.begin(); i != node.nodes.end(); ++i){
-			x += RemoveAwake((**i), removed);
+	OctNode* n = &node;
+
+	while (true){
+		if (n->children != NULL){
+			//Move down to the child holding the center of the sphere, if the sphere
+			//fits inside its loose bounds
+			OctNode& child = n->children[ChildIndex(*n, e.fatPos)];
+
+			if (Fits(child, e)){
+				n = &child;
+				continue;
+			}
+		} else if (n->spheres.size() >= static_cast<unsigned int>(threshold) && n->depth < maxDepth){
+			//The leaf is full, so give it children and push down each of its
+			//spheres that fits inside one of them
+			CreateNodes(*n);
+
+			unsigned int i = 0;
+
+			while (i < n->spheres.size()){
+				Sphere& s = *n->spheres[i];
+				OctNode& child = n->children[ChildIndex(*n, s.fatPos)];
+
+				if (!Fits(child, s)){
+					++i;
+					continue;
+				}
+
+				//The last sphere takes its place, and is looked at next
+				TakeFromLeaf(*n, i);
+				Recount(n, -1, s.countedAwake ? -1 : 0);
+
+				s.leaves.clear();
+				InsertLoose(child, s);
+			}
+
+			continue;
 		}
 
-		//Check to see if x is below the threshold, if so collapse the node.
-		if (x < threshold || x == 0){
-			CollapseNode(node);
-			return node.spheres.size();
+		//The sphere fits no deeper, so it lives in this node
+		AddToLeaf(*n, e);
+		return true;
+	}
+}
+
+bool Octree::Settled(const OctNode& node, const Sphere& e) const{
+	//It must still fit the node...
+	if (!Fits(node, e)){
+		return false;
+	}
+
+	//...and must not fit the child it would be pushed down into
+	if (node.children != NULL){
+		return !Fits(node.children[ChildIndex(node, e.fatPos)], e);
+	}
+
+	return true;
+}
+
+void Octree::FindLoosePairs(OctNode& node, const OctNode& from, Sphere& e, vector<pair<Sphere*, Sphere*>>& toBeResolved){
+	//Every sphere beneath a node lies inside its loose bounds, so if the sphere does
+	//not overlap them there is nothing to find
+	if (node.count == 0 || !OverlapsLoose(node, e)){
+		return;
+	}
+
+	//Pairs of spheres in the same node are found by CollisionResolve. Pairs of awake
+	//spheres in two different nodes are only tested from the lower addressed node, as
+	//they would otherwise be found from both, and asleep spheres are tested from the
+	//awake sphere they are paired with.
+	if (&node != &from){
+		bool lower = &node > &from;
+
+		for (unsigned int j=0; j<node.spheres.size(); ++j){
+			Sphere* s = node.spheres[j];
+
+			if ((lower || !s->getAwake()) && s->CheckCollision(e)){
+				toBeResolved.push_back(PairBuffer::Ordered(&e, s));
+			}
 		}
+	}
 
-		//Else just return how many spheres are in the node
-		return x;
+	if (node.children != NULL){
+		for (int i=0; i<8; ++i){
+			FindLoosePairs(node.children[i], from, e, toBeResolved);
+		}
 	}
 }
 
@@ -235,53 +869,307 @@ void Octree::DrawNode(SRenderer& r, OctNode& node){
 	r.Render(*cube);
 
 	//If this has nodes for children
-	if (node.nodes.size() != 0){
+	if (node.children != NULL){
 		//Render all its children
-		for (list<OctNode*>::const_iterator i = node.nodes.begin(); i != node.nodes.end(); ++i){
-			DrawNode(r, **i);
+		for (int i=0; i<8; ++i){
+			DrawNode(r, node.children[i]);
 		}
 	}
 }
 
-void Octree::Update(){
-	//Find all the awake nodes in the octree
-	set<Sphere*> awakeNodes;
+void Octree::Update(const vector<Sphere*>& changed){
+	reinsertions = 0;
+
+	//Move each changed sphere that has left the bounds of its leaf. Spheres
+	//that have not changed cannot have left theirs, nor woken or fallen asleep.
+	for (unsigned int i=0; i<changed.size(); ++i){
+		CountAwake(*changed[i]);
+		Relocate(*changed[i]);
+	}
+}
+
+void Octree::CountAwake(Sphere& e){
+	if (e.getAwake() == e.countedAwake) return;
+
+	e.countedAwake = !e.countedAwake;
+
+	for (unsigned int i=0; i<e.leaves.size(); ++i){
+		Recount(e.leaves[i].leaf, 0, e.countedAwake ? 1 : -1);
+	}
+}
+
+void Octree::ResolveCollisions(float msec){
+	//Find every leaf, so they can be shared out between the workers
+	leaves.clear();
+	GatherLeaves(root, leaves);
 
-	//Remove the awake spheres that cross boundaries of the node they are in, and collapse
-	//nodes if they are below a threshold
-	RemoveAwake(root, awakeNodes);
+	//Each worker fills its own list of pairs, so no locking is needed
+	int workerCount = workers != NULL ? workers->GetWorkerCount() : 1;
+	pairs.Reset(workerCount);
 
-	//Reinsert the removed nodes into the octree
-	for (set<Sphere*>::const_iterator i = awakeNodes.begin(); i != awakeNodes.end(); ++i){
-		InsertSphere(root, **i);
+	if (packed.size() < static_cast<unsigned int>(workerCount)){
+		packed.resize(workerCount);
 	}
+
+	ThreadPool::Job job = [&](int begin, int end, int worker){
+		for (int i = begin; i < end; ++i){
+			CollisionResolve(*leaves[i], packed[worker], pairs.Worker(worker));
+
+			//In a loose octree, spheres may also collide with spheres in any node
+			//whose loose bounds they overlap. Only awake spheres look for them.
+			if (looseness > 0.0f){
+				for (unsigned int j=0; j<leaves[i]->spheres.size(); ++j){
+					if (leaves[i]->spheres[j]->getAwake()){
+						FindLoosePairs(root, *leaves[i], *leaves[i]->spheres[j], pairs.Worker(worker));
+					}
+				}
+			}
+		}
+	};
+
+	if (workers != NULL){
+		workers->ParallelFor(leaves.size(), job);
+	} else {
+		job(0, leaves.size(), 0);
+	}
+
+	//Merge the lists into one sorted list of pairs. Spheres that straddle leaves are
+	//found once per leaf, and the merge removes the duplicates. Each pair that collides
+	//is resolved, warm started from the last frame if it was colliding then too.
+	contacts.Resolve(pairs.Merge(), msec, workers);
 }
 
-void Octree::CollisionResolve(OctNode& node, float& msec, set<pair<Sphere*, Sphere*>>& toBeResolved){
-	//This node has nodes for children, resolve nodes
-	if (node.nodes.size() != 0){
-		for (list<OctNode*>::const_iterator i = node.nodes.begin(); i != node.nodes.end(); ++i){
-			CollisionResolve(**i, msec, toBeResolved);
+void Octree::GatherLeaves(OctNode& node, vector<OctNode*>& leaves){
+	//Every collision has an awake sphere in it, and sleeping spheres are found
+	//from the awake spheres they collide with
+	if (node.awake == 0) return;
+
+	if (looseness > 0.0f){
+		//Any node can hold spheres in a loose octree, and a single sphere may still
+		//collide with spheres in other nodes. Only nodes holding an awake sphere
+		//of their own need searching.
+		int awake = node.awake;
+
+		if (node.children != NULL){
+			for (int i=0; i<8; ++i){
+				awake -= node.children[i].awake;
+			}
+		}
+
+		if (awake > 0){
+			leaves.push_back(&node);
 		}
 	}
-	//This node has spheres for children, resolve sphere collisions.
-	else {
-		//HERE WE START THE n^2 check
-		for (list<Sphere*>::const_iterator i = node.spheres.begin(); i != node.spheres.end(); ++i){
-			for (list<Sphere*>::const_iterator j = i; j != node.spheres.end(); ++j){
-				if (*j != *i){
-					if (j == node.spheres.end()) break;
+	//There can be no leaf with two spheres beneath a node with fewer than two
+	else if (node.count < 2) return;
 
-					//Testing j against i always
-					if ((*j)->getAwake()){
-						if ((*j)->CheckCollision(**i)){
-							//Add the sphere pairing to the set of sphere pairings that
-							//must be resolved.
-							toBeResolved.insert(pair<Sphere*, Sphere*>(*i, *j));
-						};
+	//This node has nodes for children, search them
+	if (node.children != NULL){
+		for (int i=0; i<8; ++i){
+			GatherLeaves(node.children[i], leaves);
+		}
+	}
+	//This node has spheres for children, it only needs searching if there are two of them
+	else if (looseness <= 0.0f && node.spheres.size() > 1){
+		leaves.push_back(&node);
+	}
+}
+
+void Octree::CollisionResolve(OctNode& node, Packed& p, vector<pair<Sphere*, Sphere*>>& toBeResolved){
+	//Leaves at the deepest level keep every sphere added to them, so the pairs of a
+	//crowded leaf are swept for rather than all tested
+	if (node.spheres.size() >= static_cast<unsigned int>(SWEEP_SIZE)){
+		SweepLeaf(node, p, toBeResolved);
+		return;
+	}
+
+	//A leaf of a few spheres has too few pairs to be worth packing
+	if (node.spheres.size() < static_cast<unsigned int>(PACK_SIZE)){
+		for (unsigned int i=0; i<node.spheres.size(); ++i){
+			Sphere* a = node.spheres[i];
+			bool awake = a->getAwake();
+
+			for (unsigned int j=i+1; j<node.spheres.size(); ++j){
+				Sphere* b = node.spheres[j];
+
+				//Two sleeping spheres are at rest against each other
+				if (awake || b->getAwake()){
+					if (b->CheckCollision(*a)){
+						//Add the sphere pairing to the list of sphere pairings that
+						//must be resolved.
+						toBeResolved.push_back(PairBuffer::Ordered(a, b));
 					}
 				}
 			}
 		}
+
+		return;
+	}
+
+	ClearPacked(p);
+
+	for (unsigned int i=0; i<node.spheres.size(); ++i){
+		Pack(p, *node.spheres[i]);
+	}
+
+	FinishPacked(p);
+
+	//HERE WE START THE n^2 check, each sphere against the 4 after it at a time
+	int count = p.spheres.size();
+
+	for (int i=0; i<count; ++i){
+		TestPacked(p, i, i + 1, count, toBeResolved);
+	}
+}
+
+void Octree::ClearPacked(Packed& p){
+	p.x.clear();
+	p.y.clear();
+	p.z.clear();
+	p.radius.clear();
+	p.awake.clear();
+	p.spheres.clear();
+}
+
+void Octree::Pack(Packed& p, Sphere& s){
+	Vector3 position = s.getPos();
+
+	p.x.push_back(position.x);
+	p.y.push_back(position.y);
+	p.z.push_back(position.z);
+	p.radius.push_back(s.radius);
+	p.awake.push_back(s.getAwake() ? -1 : 0);
+	p.spheres.push_back(&s);
+}
+
+void Octree::FinishPacked(Packed& p){
+	//The padding is never reported, as lanes past the end are masked off
+	for (int i=0; i<3; ++i){
+		p.x.push_back(0.0f);
+		p.y.push_back(0.0f);
+		p.z.push_back(0.0f);
+		p.radius.push_back(0.0f);
+		p.awake.push_back(0);
+	}
+}
+
+void Octree::TestPacked(const Packed& p, int i, int begin, int end, vector<pair<Sphere*, Sphere*>>& toBeResolved){
+	__m128 x = _mm_set1_ps(p.x[i]);
+	__m128 y = _mm_set1_ps(p.y[i]);
+	__m128 z = _mm_set1_ps(p.z[i]);
+	__m128 r = _mm_set1_ps(p.radius[i]);
+
+	//Two sleeping spheres are at rest against each other, so a sleeping sphere is
+	//only tested against the awake spheres
+	__m128 awake = _mm_castsi128_ps(_mm_set1_epi32(p.awake[i]));
+
+	for (int j = begin; j < end; j += 4){
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&p.x[j]), x);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&p.y[j]), y);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&p.z[j]), z);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		__m128 reach = _mm_add_ps(_mm_loadu_ps(&p.radius[j]), r);
+		__m128 hit = _mm_cmplt_ps(d2, _mm_mul_ps(reach, reach));
+		hit = _mm_and_ps(hit, _mm_or_ps(awake, _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&p.awake[j])))));
+
+		//Only the lanes before the end hold spheres in the range
+		int hits = _mm_movemask_ps(hit);
+		if (end - j < 4) hits &= (1 << (end - j)) - 1;
+
+		for (int k = 0; hits != 0; ++k, hits >>= 1){
+			if (hits & 1){
+				//Add the sphere pairing to the list of sphere pairings that
+				//must be resolved.
+				toBeResolved.push_back(PairBuffer::Ordered(p.spheres[i], p.spheres[j + k]));
+			}
+		}
+	}
+}
+
+//Orders the spheres of a sweep by where they start along its axis
+static bool SweepLess(const SweepEntry& a, const SweepEntry& b){
+	return a.low < b.low;
+}
+
+void Octree::SweepLeaf(OctNode& node, Packed& p, vector<pair<Sphere*, Sphere*>>& toBeResolved){
+	vector<SweepEntry>& sweep = node.sweep;
+
+	//A sweep emptied by a change to the leaf is filled again from its spheres
+	bool resort = sweep.size() != node.spheres.size();
+
+	if (resort){
+		sweep.clear();
+
+		for (unsigned int i=0; i<node.spheres.size(); ++i){
+			SweepEntry entry;
+			entry.sphere = node.spheres[i];
+			sweep.push_back(entry);
+		}
 	}
-}
\ No newline at end of file
+
+	//Sweep along the axis the spheres are spread furthest along
+	Vector3 sum, squares;
+
+	for (unsigned int i=0; i<sweep.size(); ++i){
+		Vector3 position = sweep[i].sphere->getPos();
+		sum = sum + position;
+		squares = squares + Vector3(position.x * position.x, position.y * position.y, position.z * position.z);
+	}
+
+	float n = static_cast<float>(sweep.size());
+	Vector3 variance = squares / n - Vector3(sum.x * sum.x, sum.y * sum.y, sum.z * sum.z) / (n * n);
+
+	int axis = 0;
+	if (variance.y > variance.x) axis = 1;
+	if (variance.z > (axis == 0 ? variance.x : variance.y)) axis = 2;
+
+	if (axis != node.sweepAxis){
+		node.sweepAxis = axis;
+		resort = true;
+	}
+
+	for (unsigned int i=0; i<sweep.size(); ++i){
+		Sphere& s = *sweep[i].sphere;
+		Vector3 position = s.getPos();
+		float c = axis == 0 ? position.x : (axis == 1 ? position.y : position.z);
+
+		sweep[i].low = c - s.radius;
+		sweep[i].high = c + s.radius;
+	}
+
+	if (resort){
+		std::sort(sweep.begin(), sweep.end(), SweepLess);
+	} else {
+		//The spheres have barely moved since the last frame, so the order is nearly sorted
+		for (unsigned int i=1; i<sweep.size(); ++i){
+			SweepEntry entry = sweep[i];
+			unsigned int j = i;
+
+			for (; j > 0 && sweep[j - 1].low > entry.low; --j){
+				sweep[j] = sweep[j - 1];
+			}
+
+			sweep[j] = entry;
+		}
+	}
+
+	ClearPacked(p);
+
+	for (unsigned int i=0; i<sweep.size(); ++i){
+		Pack(p, *sweep[i].sphere);
+	}
+
+	FinishPacked(p);
+
+	//Each sphere is tested against the spheres that start before it ends, 4 at a time
+	int count = sweep.size();
+	int end = 0;
+
+	for (int i=0; i<count; ++i){
+		if (end < i + 1) end = i + 1;
+		while (end < count && sweep[end].low <= sweep[i].high) end++;
+
+		TestPacked(p, i, i + 1, end, toBeResolved);
+	}
+}
@@ -1,49 +1,56 @@
 #pragma once
 
 #include <list>
-#include <set>
+#include <vector>
+#include <mutex>
 #include "Sphere.h"
+#include "BroadPhase.h"
+#include "OctNodePool.h"
+#include "ThreadPool.h"
+#include "PairBuffer.h"
+#include "ContactCache.h"
+#include "Morton.h"
 
 #include "MeshManager.h"
 #include "ShaderManager.h"
 #include "TextureManager.h"
 
-using std::set;
 using std::list;
 using std::pair;
+using std::vector;
 
-//An "OctNode" represents one node in an octree
-struct OctNode {
-	//A pointer to the parent of each node
-	OctNode* parent;
+class Octree : public BroadPhase
+{
+public:
+	//The number of spheres a leaf must hold before its spheres are sorted and swept
+	//for collisions, rather than each tested against every other
+	static const int SWEEP_SIZE = 24;
 
-	//Size is always a positive vector that represents the height, width and depth of the node
-	Vector3 size;
+	//The number of spheres a leaf must hold before its spheres are packed, so each
+	//can be tested against 4 others at once
+	static const int PACK_SIZE = 6;
 
-	//Position always denotes the lowest x, y and z coords of the node. Its highest points are
-	//position + size
-	Vector3 pos;
+	//Creates a Octree from - 1/2 size to 1/2 size. If supplied, the workers are used
+	//to search the leaves for collisions in parallel. A looseness of 0 stores spheres
+	//in every leaf they overlap. Any other looseness (at least 1) makes a loose octree,
+	//where each node's bounds are enlarged to looseness times its size and each
+	//sphere is stored in exactly one node.
+	Octree(Vector3 size, int threshold, int maxDepth, ThreadPool* workers = NULL, float looseness = 0.0f);
 
-	//We store a list of spheres if this node contains a number of spheres below the threshold.
-	//We use a list because they are always checked sequentially.
-	list<Sphere*> spheres;
+	//The node pool releases every node in the tree.
+	~Octree(void){ };
 
-	//We store a list of nodes if this node contains a number of nodes above the threshold.
-	//We use a list because they are always check sequentially.
-	list<OctNode*> nodes;
-};
-
-class Octree
-{
-public:
-	//Creates a Octree from - 1/2 size to 1/2 size
-	Octree(Vector3 size, int threshold, int maxDepth);
+	//This is added to the correct octNode depending on its x, y, and z coords of each face
+	virtual bool AddSphere(Sphere& e);
 
-	//Collapse the root node.
-	Octree::~Octree(void){ CollapseNode(root); }
+	//Adds a batch of spheres. An empty octree is built from the whole batch at once
+	//(see Build), otherwise the spheres are inserted one at a time.
+	virtual int AddSpheres(vector<Sphere*>& batch);
 
-	//This is added to the correct octNode depending on its x, y, and z coords of each face
-	bool AddSphere(Sphere& e);
+	//Removes a sphere from each leaf it is stored in, collapsing any nodes that fall
+	//below the threshold. Only the leaves the sphere is stored in are visited. The
+	//sphere's contacts are forgotten.
+	virtual void RemoveSphere(Sphere& e);
 
 
 	//OStream method for an Octree.
@@ -52,85 +59,334 @@ public:
 		return o;
 	}
 
+	//The number of sphere references held by the nodes (spheres stored in several
+	//leaves are counted once per leaf)
+	inline int GetEntryCount() const { return root.count; }
+
+	//Returns the pool the nodes of this octree are allocated from
+	inline const OctNodePool& GetNodePool() const { return pool; }
+
 	//Pass the Octree a renderer to have it render itself
-	inline void Draw(SRenderer& r){
+	virtual void Draw(SRenderer& r){
 		DrawNode(r, root);
 	}
 
 	//Update an octree to check that all nodes in it are consistent.
-	//(Basically a resort of all awake nodes, more efficient ways are
-	//beyond the scope of this assignment)
-	void Update();
+	//Changed spheres that have escaped their fat bounds are moved, starting
+	//from the nearest node that still contains them rather than the root.
+	virtual void Update(const vector<Sphere*>& changed);
+
+	//Sets the margin the fat bounds of a sphere are given. The bounds stretch
+	//velocityScale frames ahead along the sphere's velocity, plus padding all round.
+	virtual void SetMargin(float velocityScale, float padding){
+		this->velocityScale = velocityScale;
+		this->padding = padding;
+	}
+
+	//Classifies every node against the planes, so each node knows which planes a
+	//sphere centered in it may touch. New nodes are classified as they are created.
+	virtual void SetPlanes(const PlaneSet& planes);
+
+	//Returns the planes of the nodes a sphere is stored in. Spheres that have left
+	//their fat bounds since the last update, or the world, are given every plane.
+	virtual PlaneMask NearbyPlanes(const Sphere& e) const;
+
+	//The number of spheres taken out of the tree and reinserted by the last update
+	inline int GetReinsertions() const { return reinsertions; }
 
 	//Resolve all the collisions of SPHERES in an octree
-	inline void ResolveCollisions(float msec){
-		//Create a set of pairs to add overlapping spheres too
-		set<pair<Sphere*, Sphere*>> toBeResolved;
+	virtual void ResolveCollisions(float msec);
 
-		//Find all nodes that overlap
-		CollisionResolve(root, msec, toBeResolved);
+	//Sets the number of times the contacts between spheres are solved each frame
+	virtual void SetSolverIterations(int iterations){ contacts.SetIterations(iterations); }
 
-		//Resolve each pair that collides
-		for (set<pair<Sphere*, Sphere*>>::const_iterator i = toBeResolved.begin(); i != toBeResolved.end(); ++i){
-			i->first->ResolveCollision(*i->second, msec);
-		}
-	};
+	//The pairs of spheres found colliding by the last resolve
+	virtual const vector<PairBuffer::SpherePair>& GetContacts() const { return pairs.GetMerged(); }
 
 protected:
+	//The pool every node beneath the root is allocated from. Declared before
+	//the root so that it outlives it.
+	OctNodePool pool;
+
 	//The root node of the octree
 	OctNode root;
 	int threshold; //The number of spheres added to cause a split
 	int maxDepth; //The number of parents a node is allowed.
+	float looseness; //How many times larger a node's loose bounds are. 0 if not loose.
+
+	//Spheres are stored by their fat bounds, which are grown by this margin
+	float velocityScale;
+	float padding;
+
+	int reinsertions;
+
+	//The planes of the world (NULL until they are set), and the radius the nodes
+	//were classified against them with, which covers every sphere in the tree
+	const PlaneSet* planes;
+	float planeRadius;
 
 	//A RenderObject for easy rendering of the octree (Would not be present
 	// in a fully fledged physics engine).
 	RenderObject* cube;
 
-	//Create a node given its node number (denotes its position within its parent)
-	OctNode* CreateNode(int nodeNumber, OctNode& parent);
+	//The threads used to search the leaves for collisions. NULL to search serially.
+	ThreadPool* workers;
+
+	//The leaves searched for collisions, and the pairs found in them. Both are kept
+	//between frames so their memory is reused.
+	vector<OctNode*> leaves;
+	PairBuffer pairs;
+
+	//The contacts between spheres, remembered from frame to frame
+	ContactCache contacts;
+
+	//The centers, radii and awake flags of the spheres of a leaf, one array per
+	//component, so one sphere can be tested against 4 others at once. Positions change
+	//every frame, so each worker packs the leaves it searches into its own copy. The
+	//arrays are padded by 3, so the last group of 4 can always be loaded.
+	struct Packed {
+		vector<float> x, y, z, radius;
+		vector<int> awake;
+		vector<Sphere*> spheres;
+	};
+	vector<Packed> packed;
+
+	//Nodes that may have fallen below the threshold since spheres were removed
+	//from beneath them, and the path from a leaf to the root. Both are scratch
+	//space for moving and removing spheres.
+	vector<OctNode*> collapseCandidates;
+	vector<OctNode*> path;
+
+	//A subtree left by Build to be built by a worker
+	struct BuildTask {
+		OctNode* node;
+		int begin, end;
+
+		//The number of spheres in the range that are still to be placed (loose only)
+		int count;
+
+		//The spheres from outside the range that touch the node (strict only)
+		vector<int> extras;
+	};
+
+	//Used to build the tree in one go. The spheres being added sorted into Morton order,
+	//their codes, and whether each has been placed in a node (loose only). All three
+	//are emptied once the tree is built.
+	vector<Sphere*> building;
+	vector<unsigned int> codes;
+	vector<char> placed;
+
+	//The depth Build hands subtrees to the workers at
+	int taskDepth;
+
+	//Subtrees are built in parallel, so the workers share the pool through this
+	std::mutex poolLock;
+
+	//Builds an empty octree from the first count spheres of the batch. The spheres are
+	//sorted into Morton order of their centers, so the spheres centered in any node are
+	//one contiguous range. The top of the tree is built serially, then the subtrees
+	//beneath it are shared out between the workers. Every sphere's leaf entries and
+	//every node's count are filled in by a final serial pass.
+	void Build(vector<Sphere*>& batch, int count);
+
+	//Builds the node of a strict octree holding the spheres centered in [begin, end), and
+	//the extra spheres centered outside it that touch it. If supplied, subtrees at
+	//the task depth are added to the tasks rather than built.
+	void BuildNode(OctNode& node, int begin, int end, vector<int>& extras, vector<BuildTask>* tasks);
+
+	//Builds the node of a loose octree holding the spheres centered in [begin, end),
+	//count of which have not yet been placed in one of its ancestors
+	void BuildLooseNode(OctNode& node, int begin, int end, int count, vector<BuildTask>* tasks);
+
+	//Records every sphere's leaf entries beneath a built node, and sets the counts of
+	//the nodes
+	void Link(OctNode& node);
+
+	//Returns the cell of a Morton code a coordinate lies in along one axis of the world
+	inline unsigned int Cell(float v, float low, float size, int cells) const{
+		int c = static_cast<int>((v - low) / size * cells);
+		if (c < 0) return 0;
+		if (c >= cells) return cells - 1;
+		return c;
+	}
+
+	//Initialise a child of a node given its node number (denotes its position within its parent)
+	void CreateNode(int nodeNumber, OctNode& parent);
 
-	//Use this to create 8 nodes at the supplied node
+	//Use this to allocate a block of 8 nodes from the pool for the supplied node
 	void CreateNodes(OctNode& node);
 
+	//Sets the planes of a node to those of the candidates that cut its bounds
+	void ClassifyNode(OctNode& node, PlaneMask candidates);
+
+	//Classifies a node and every node beneath it against the planes
+	void ClassifyTree(OctNode& node, PlaneMask candidates);
+
+	//Makes sure the nodes were classified with a radius at least as large as the
+	//supplied sphere's, classifying the whole tree again if not
+	void CoverRadius(const Sphere& e);
+
 	//Recursive method to insert a sphere into an octnode
 	bool InsertSphere(OctNode& node, Sphere& e);
 
+	//InsertSphere for a node the sphere is known to touch
+	void InsertTouching(OctNode& node, Sphere& e);
+
+	//Returns whether the fat bounds of a sphere touch a node, which is when
+	//InsertSphere will store the sphere in the node or its children. The sphere
+	//touches the node if its center is within its radius of the nearest point
+	//of the node.
+	bool Touches(const OctNode& node, const Sphere& e) const;
+
+	//Returns a mask with bit i set if the fat bounds of a sphere touch child i of a
+	//node, testing all 8 children at once
+	int TouchedChildren(const OctNode& node, const Sphere& e) const;
+
+	//Stores a sphere in a leaf, recording where it is stored in the sphere
+	void AddToLeaf(OctNode& leaf, Sphere& e);
+
+	//Takes the sphere at an index out of a leaf. The last sphere of the leaf is moved
+	//into its place, and told where it now is.
+	void TakeFromLeaf(OctNode& leaf, int index);
+
+	//Adds to the number of spheres, and awake spheres, held by a node and every node above it
+	inline void Recount(OctNode* node, int count, int awake){
+		for (OctNode* n = node; n != NULL; n = n->parent){
+			n->count += count;
+			n->awake += awake;
+		}
+	}
+
+	//Brings the awake counts of the nodes a sphere is stored in up to date, if the
+	//sphere has fallen asleep or woken since they were last counted
+	void CountAwake(Sphere& e);
+
+	//Removes a sphere from every leaf it is stored in. The parents of those
+	//leaves are added to the collapse candidates.
+	void RemoveFromLeaves(Sphere& e);
+
 	//A collapse node method, used when a node contains a nodes for children,
 	// whose total number of spheres is less than the threshold, and will collapse it.
 	void CollapseNode(OctNode& node);
 
-	//Recursive method to search through an octnode and remove all awake nodes from 
-	//it, adding them to a set supplied to it.
-	int RemoveAwake(OctNode& node, set<Sphere*>& removed);
+	//Collapses every collapse candidate that has fallen below the threshold, and
+	//then any of their parents that fall below it as a result.
+	void CollapseCandidates();
+
+	//Moves a sphere that has escaped its fat bounds, if its new fat bounds have
+	//left the bounds of its leaf
+	void Relocate(Sphere& e);
+
+	//Fits new fat bounds around a sphere, from its current position and velocity
+	inline void SetFatBounds(Sphere& e) const{
+		Vector3 position = e.getPos();
+		Vector3 step = (position - e.getLastPos()) * (velocityScale * 0.5f);
+		float reach = position.GetDistance(e.getLastPos()) * velocityScale * 0.5f;
+
+		e.fatPos = position + step;
+		e.fatRadius = e.radius + reach + padding;
+	}
+
+	//Returns whether a sphere still lies inside its fat bounds
+	inline bool InFatBounds(const Sphere& e) const{
+		float r = e.fatRadius - e.radius;
+		return r >= 0.0f && e.getPos().GetDistanceNSq(e.fatPos) <= r * r;
+	}
+
+	//Returns whether a sphere's fat bounds lie entirely inside a node, touching none of its faces
+	inline bool Contains(const OctNode& node, const Sphere& e) const{
+		Vector3 p = e.fatPos;
+		float r = e.fatRadius;
+
+		return p.x - r > node.pos.x && p.x + r < node.pos.x + node.size.x &&
+			p.y - r > node.pos.y && p.y + r < node.pos.y + node.size.y &&
+			p.z - r > node.pos.z && p.z + r < node.pos.z + node.size.z;
+	}
+
+	//Inserts a sphere into a loose octree, in the deepest node beneath the supplied
+	//node whose loose bounds it fits inside
+	bool InsertLoose(OctNode& node, Sphere& e);
+
+	//Returns whether a sphere stored in a node of a loose octree is still in the
+	//node it would be inserted into
+	bool Settled(const OctNode& node, const Sphere& e) const;
+
+	//Tests an awake sphere against the spheres in every node beneath the supplied
+	//node whose loose bounds it overlaps. from is the node the sphere is stored in.
+	void FindLoosePairs(OctNode& node, const OctNode& from, Sphere& e, vector<pair<Sphere*, Sphere*>>& toBeResolved);
+
+	//Returns the index of the child of a node that holds the supplied point
+	inline int ChildIndex(const OctNode& node, const Vector3& p) const{
+		int i = 0;
+		if (p.x >= node.pos.x + node.size.x * 0.5f) i |= 4;
+		if (p.y >= node.pos.y + node.size.y * 0.5f) i |= 2;
+		if (p.z >= node.pos.z + node.size.z * 0.5f) i |= 1;
+		return i;
+	}
+
+	//Returns whether the bounding box of a sphere's fat bounds touches a node
+	inline bool Overlaps(const OctNode& node, const Sphere& e) const{
+		Vector3 p = e.fatPos;
+		float r = e.fatRadius;
+
+		return p.x + r >= node.pos.x && p.x - r <= node.pos.x + node.size.x &&
+			p.y + r >= node.pos.y && p.y - r <= node.pos.y + node.size.y &&
+			p.z + r >= node.pos.z && p.z - r <= node.pos.z + node.size.z;
+	}
+
+	//Returns whether the bounding box of a sphere's fat bounds touches the loose bounds of a node
+	inline bool OverlapsLoose(const OctNode& node, const Sphere& e) const{
+		Vector3 p = e.fatPos;
+		float r = e.fatRadius;
+		float m = (looseness - 1.0f) * 0.5f;
+
+		return p.x + r >= node.pos.x - node.size.x * m && p.x - r <= node.pos.x + node.size.x * (1.0f + m) &&
+			p.y + r >= node.pos.y - node.size.y * m && p.y - r <= node.pos.y + node.size.y * (1.0f + m) &&
+			p.z + r >= node.pos.z - node.size.z * m && p.z - r <= node.pos.z + node.size.z * (1.0f + m);
+	}
+
+	//Returns whether a sphere's fat bounds lie entirely inside the loose bounds of a node
+	inline bool Fits(const OctNode& node, const Sphere& e) const{
+		Vector3 p = e.fatPos;
+		float r = e.fatRadius;
+		float m = (looseness - 1.0f) * 0.5f;
+
+		return p.x - r >= node.pos.x - node.size.x * m && p.x + r <= node.pos.x + node.size.x * (1.0f + m) &&
+			p.y - r >= node.pos.y - node.size.y * m && p.y + r <= node.pos.y + node.size.y * (1.0f + m) &&
+			p.z - r >= node.pos.z - node.size.z * m && p.z + r <= node.pos.z + node.size.z * (1.0f + m);
+	}
 
 	//Recursive method to draw an oct node, and its children (if present).
 	//NOTE, DOES NOT DRAW SPHERES
 	void DrawNode(SRenderer& r, OctNode& node);
 
-	//Recursively search for a node with spheres for children, then perform narrow phase
-	//check for collision. If colliding, adds to a set of sphere pairs to have their
+	//Recursively search for nodes with spheres for children, adding them to the supplied list.
+	//Subtrees without an awake sphere are skipped.
+	void GatherLeaves(OctNode& node, vector<OctNode*>& leaves);
+
+	//Perform narrow phase check for collision between the spheres of a leaf, where at least
+	//one of the pair is awake. If colliding, adds to a list of sphere pairs to have their
 	//collisions resolved at a later date.
-	void CollisionResolve(OctNode& node, float& msec, set<pair<Sphere*, Sphere*>>& toBeResolved);
+	void CollisionResolve(OctNode& node, Packed& p, vector<pair<Sphere*, Sphere*>>& toBeResolved);
 
-	//Calculates the number of parents of a node. This is used to block the recursion.
-	//It may be more efficient to store the number of parents a node has when it is created,
-	//but ultra efficiency is beyond the scope of this assignment.
-	int NumberOfParents(OctNode& node){
-		OctNode* s = node.parent;
+	//CollisionResolve for a crowded leaf. Its spheres are sorted by where they start
+	//along the leaf's sweep axis, and each is only tested against the spheres that
+	//start before it ends. The order of the last frame is sorted again by insertion,
+	//unless spheres have joined or left the leaf or the axis has changed.
+	void SweepLeaf(OctNode& node, Packed& p, vector<pair<Sphere*, Sphere*>>& toBeResolved);
 
-		if (s == NULL){
-			return 0;
-		}
+	//Empties a packed copy, ready for the spheres of another leaf
+	void ClearPacked(Packed& p);
 
-		int x = 1;
+	//Adds a sphere to the end of a packed copy
+	void Pack(Packed& p, Sphere& s);
 
-		while (s->parent != NULL){
-			s = s->parent;
-			x++;
-		}
+	//Pads a packed copy once every sphere has been added
+	void FinishPacked(Packed& p);
 
-		return x;
-	};
+	//Tests the packed sphere i against the packed spheres in [begin, end), 4 at a
+	//time, adding the pairs that collide where at least one sphere is awake
+	void TestPacked(const Packed& p, int i, int begin, int end, vector<pair<Sphere*, Sphere*>>& toBeResolved);
 
 	//A print method for a node
 	void printNode(std::ostream& where, const OctNode& node) const{
@@ -140,15 +396,17 @@ protected:
 		if (node.spheres.size() != 0){
 			where << "SPHERE LIST: " << std::endl;
 
-			for (std::list<Sphere*>::const_iterator i = node.spheres.begin(); i != node.spheres.end(); ++i){
-				where << **i << std::endl;
+			for (unsigned int i=0; i<node.spheres.size(); ++i){
+				where << *node.spheres[i] << std::endl;
 			}
 		} else {
 
 			where << "NODE LIST: " << std::endl;
 
-			for (std::list<OctNode*>::const_iterator i = node.nodes.begin(); i != node.nodes.end(); ++i){
-				printNode(where, **i);
+			if (node.children != NULL){
+				for (int i=0; i<8; ++i){
+					printNode(where, node.children[i]);
+				}
 			}
 		}
 	}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+class Sphere;
+
+using std::vector;
+using std::pair;
+
+/**
+* Collects the pairs of colliding spheres found by a broad phase. Each worker adds
+* pairs to its own list, and the lists are then merged into one sorted list with the
+* duplicates removed, in the same order a std::set of the pairs would be in.
+*
+* Every list keeps its memory between frames, so once it has grown to the number of
+* pairs in the scene, finding and merging pairs does not allocate.
+*/
+class PairBuffer
+{
+public:
+	typedef pair<Sphere*, Sphere*> SpherePair;
+
+	//Returns a pair with the lower addressed sphere first. Pairs are always stored this
+	//way, so a pair found from both of its spheres is merged into one.
+	static inline SpherePair Ordered(Sphere* a, Sphere* b){
+		return a < b ? SpherePair(a, b) : SpherePair(b, a);
+	}
+
+	//Empties every list, making sure there is one for each of the supplied workers
+	inline void Reset(int workerCount){
+		if (found.size() < static_cast<unsigned int>(workerCount)){
+			found.resize(workerCount);
+		}
+
+		for (unsigned int i=0; i<found.size(); ++i){
+			found[i].clear();
+		}
+		merged.clear();
+	}
+
+	//The list a worker adds the pairs it finds to
+	inline vector<SpherePair>& Worker(int worker){
+		return found[worker];
+	}
+
+	//Merges every worker's pairs into a single sorted list of unique pairs
+	inline const vector<SpherePair>& Merge(){
+		for (unsigned int i=0; i<found.size(); ++i){
+			merged.insert(merged.end(), found[i].begin(), found[i].end());
+		}
+
+		std::sort(merged.begin(), merged.end());
+		merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+
+		return merged;
+	}
+
+	//The pairs of the last merge
+	inline const vector<SpherePair>& GetMerged() const{
+		return merged;
+	}
+
+protected:
+	//The pairs found by each worker
+	vector<vector<SpherePair>> found;
+
+	//Every worker's pairs, sorted and without duplicates
+	vector<SpherePair> merged;
+};
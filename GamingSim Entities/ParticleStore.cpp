@@ -0,0 +1,169 @@
+#include "ParticleStore.h"
+#include "Sphere.h"
+#include <algorithm>
+#include <emmintrin.h>
+
+const float ParticleStore::REST_SPEED = 0.01f;
+
+ParticleStore::ParticleStore(void)
+{
+	count = 0;
+	awakeCount = 0;
+}
+
+ParticleStore::~ParticleStore(void)
+{
+}
+
+void ParticleStore::Resize(int particles){
+	//Round up to a whole group of 4
+	int padded = (particles + 3) & ~3;
+
+	px.resize(padded, 0.0f); py.resize(padded, 0.0f); pz.resize(padded, 0.0f);
+	lx.resize(padded, 0.0f); ly.resize(padded, 0.0f); lz.resize(padded, 0.0f);
+	sx.resize(padded, 0.0f); sy.resize(padded, 0.0f); sz.resize(padded, 0.0f);
+	ax.resize(padded, 0.0f); ay.resize(padded, 0.0f); az.resize(padded, 0.0f);
+	drag.resize(padded, 0.0f);
+	rest.resize(padded, 0.0f);
+	awake.resize(padded, 0);
+	owners.resize(padded, NULL);
+}
+
+int ParticleStore::Add(Sphere* owner, const Vector3& position, float drag){
+	int i = count;
+	Resize(count + 1);
+	count++;
+
+	SetPosition(i, position);
+	SetLastPos(i, position);
+	SetStart(i, position);
+	SetAccel(i, Vector3(0, 0, 0));
+	this->drag[i] = drag;
+	rest[i] = 0.0f;
+	awake[i] = -1;
+	owners[i] = owner;
+
+	//New particles are awake, so join the end of the awake particles
+	Swap(i, awakeCount);
+
+	return awakeCount++;
+}
+
+void ParticleStore::Remove(int index){
+	//An awake particle is first swapped to the end of the awake particles, so they
+	//stay together when it is gone
+	if (index < awakeCount){
+		Swap(index, --awakeCount);
+		index = awakeCount;
+	}
+
+	int last = count - 1;
+
+	//Move the last particle into the removed particle's place
+	if (index != last){
+		px[index] = px[last]; py[index] = py[last]; pz[index] = pz[last];
+		lx[index] = lx[last]; ly[index] = ly[last]; lz[index] = lz[last];
+		sx[index] = sx[last]; sy[index] = sy[last]; sz[index] = sz[last];
+		ax[index] = ax[last]; ay[index] = ay[last]; az[index] = az[last];
+		drag[index] = drag[last];
+		rest[index] = rest[last];
+		awake[index] = awake[last];
+		owners[index] = owners[last];
+
+		owners[index]->particle = index;
+	}
+
+	//The last slot becomes padding, which must never wake
+	awake[last] = 0;
+	owners[last] = NULL;
+
+	count--;
+	Resize(count);
+}
+
+void ParticleStore::Swap(int a, int b){
+	if (a == b) return;
+
+	std::swap(px[a], px[b]); std::swap(py[a], py[b]); std::swap(pz[a], pz[b]);
+	std::swap(lx[a], lx[b]); std::swap(ly[a], ly[b]); std::swap(lz[a], lz[b]);
+	std::swap(sx[a], sx[b]); std::swap(sy[a], sy[b]); std::swap(sz[a], sz[b]);
+	std::swap(ax[a], ax[b]); std::swap(ay[a], ay[b]); std::swap(az[a], az[b]);
+	std::swap(drag[a], drag[b]);
+	std::swap(rest[a], rest[b]);
+	std::swap(awake[a], awake[b]);
+	std::swap(owners[a], owners[b]);
+
+	owners[a]->particle = a;
+	owners[b]->particle = b;
+}
+
+void ParticleStore::Integrate(float time, int begin, int end, vector<int>& moved){
+	const __m128 t2 = _mm_set1_ps(time * time);
+
+	int padded = px.size();
+	if (end > padded) end = padded;
+
+	for (int i = begin; i < end; i += 4){
+		__m128 on = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&awake[i])));
+		int onBits = _mm_movemask_ps(on);
+
+		//Nothing to do for a group that is entirely asleep
+		if (onBits == 0) continue;
+
+		__m128 d = _mm_loadu_ps(&drag[i]);
+
+		//position += ((position - lastPos) + accel * t^2) * drag, for each axis
+		__m128 x = _mm_loadu_ps(&px[i]);
+		__m128 nx = _mm_add_ps(x, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(x, _mm_loadu_ps(&lx[i])), _mm_mul_ps(_mm_loadu_ps(&ax[i]), t2)), d));
+
+		__m128 y = _mm_loadu_ps(&py[i]);
+		__m128 ny = _mm_add_ps(y, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(y, _mm_loadu_ps(&ly[i])), _mm_mul_ps(_mm_loadu_ps(&ay[i]), t2)), d));
+
+		__m128 z = _mm_loadu_ps(&pz[i]);
+		__m128 nz = _mm_add_ps(z, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(z, _mm_loadu_ps(&lz[i])), _mm_mul_ps(_mm_loadu_ps(&az[i]), t2)), d));
+
+		//Awake particles move to their new positions, and their old positions become
+		//their last, and where they started the step. Asleep particles keep all three.
+		_mm_storeu_ps(&px[i], _mm_or_ps(_mm_and_ps(on, nx), _mm_andnot_ps(on, x)));
+		_mm_storeu_ps(&py[i], _mm_or_ps(_mm_and_ps(on, ny), _mm_andnot_ps(on, y)));
+		_mm_storeu_ps(&pz[i], _mm_or_ps(_mm_and_ps(on, nz), _mm_andnot_ps(on, z)));
+
+		_mm_storeu_ps(&lx[i], _mm_or_ps(_mm_and_ps(on, x), _mm_andnot_ps(on, _mm_loadu_ps(&lx[i]))));
+		_mm_storeu_ps(&ly[i], _mm_or_ps(_mm_and_ps(on, y), _mm_andnot_ps(on, _mm_loadu_ps(&ly[i]))));
+		_mm_storeu_ps(&lz[i], _mm_or_ps(_mm_and_ps(on, z), _mm_andnot_ps(on, _mm_loadu_ps(&lz[i]))));
+
+		_mm_storeu_ps(&sx[i], _mm_or_ps(_mm_and_ps(on, x), _mm_andnot_ps(on, _mm_loadu_ps(&sx[i]))));
+		_mm_storeu_ps(&sy[i], _mm_or_ps(_mm_and_ps(on, y), _mm_andnot_ps(on, _mm_loadu_ps(&sy[i]))));
+		_mm_storeu_ps(&sz[i], _mm_or_ps(_mm_and_ps(on, z), _mm_andnot_ps(on, _mm_loadu_ps(&sz[i]))));
+
+		for (int j = 0; j < 4; ++j){
+			if (onBits & (1 << j)) moved.push_back(i + j);
+		}
+	}
+}
+
+void ParticleStore::MeasureRest(float time, int begin, int end){
+	const __m128 dt = _mm_set1_ps(time);
+	const __m128 still = _mm_set1_ps(REST_SPEED * time);
+	const __m128 sign = _mm_set1_ps(-0.0f);
+
+	int padded = px.size();
+	if (end > padded) end = padded;
+
+	for (int i = begin; i < end; i += 4){
+		__m128 on = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&awake[i])));
+		if (_mm_movemask_ps(on) == 0) continue;
+
+		//The particle is at rest if it ended the step closer to where it started than
+		//the rest speed allows, along every axis
+		__m128 resting = _mm_cmplt_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(&px[i]), _mm_loadu_ps(&sx[i]))), still);
+		resting = _mm_and_ps(resting, _mm_cmplt_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(&py[i]), _mm_loadu_ps(&sy[i]))), still));
+		resting = _mm_and_ps(resting, _mm_cmplt_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(&pz[i]), _mm_loadu_ps(&sz[i]))), still));
+
+		//An awake particle at rest adds the interval to its time at rest, and one that
+		//moved starts again from 0
+		__m128 r = _mm_loadu_ps(&rest[i]);
+		__m128 nr = _mm_and_ps(resting, _mm_add_ps(r, dt));
+		_mm_storeu_ps(&rest[i], _mm_or_ps(_mm_and_ps(on, nr), _mm_andnot_ps(on, r)));
+	}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include "Vector3.h"
+
+class Sphere;
+
+using std::vector;
+
+/**
+* Holds the state of every sphere that integration touches (position, last position,
+* where it started the step, acceleration, drag, how long it has been at rest and
+* whether it is awake) as one array per component, so the integrator streams through
+* contiguous memory rather than chasing pointers to spheres. A sphere keeps the index
+* of its particle, and reads and writes its state through the store.
+*
+* The awake particles are kept at the front of the arrays, before every sleeping
+* particle, so the passes over moving spheres only visit the awake particles and cost
+* nothing for the rest of the world. Waking or sleeping a particle swaps it with the
+* particle at the boundary. The arrays are padded to a multiple of 4 with sleeping
+* particles, so the integrator always works on whole groups of 4.
+*/
+class ParticleStore
+{
+public:
+	friend class ContactCache;
+
+	//The speed along every axis a particle must be slower than to be at rest. Loose
+	//enough that the spheres of a pile jostling each other count as resting.
+	static const float REST_SPEED;
+
+	ParticleStore(void);
+	~ParticleStore(void);
+
+	//Adds an awake particle at rest for the supplied sphere, returning its index
+	int Add(Sphere* owner, const Vector3& position, float drag);
+
+	//Removes a particle. Particles are moved into its place, and their spheres are
+	//told their new indices.
+	void Remove(int index);
+
+	//Integrates every awake particle in [begin, end) over the supplied time interval,
+	//4 at a time. begin must be a multiple of 4, and end may run past the awake
+	//particles into the sleeping particles or the padding. The
+	//indices of the particles integrated are added to moved. Where each particle
+	//started the step is kept for MeasureRest.
+	void Integrate(float time, int begin, int end, vector<int>& moved);
+
+	//Adds the supplied interval to the time at rest of every awake particle in
+	//[begin, end) that ended the step within the rest speed of where it started it,
+	//and sets it back to 0 for the others. Called once every collision of the step
+	//has been resolved, so a particle held up against gravity counts as resting. The
+	//range is as for Integrate. Particles are never put to sleep here: whole islands
+	//of touching particles are put to sleep once all of them have rested long enough.
+	void MeasureRest(float time, int begin, int end);
+
+	//The number of particles in the store
+	inline int GetCount() const { return count; }
+
+	//The number of awake particles, which are the first in the store
+	inline int GetAwakeCount() const { return awakeCount; }
+
+	//The number of groups of 4 particles the integrator works on: those holding
+	//any awake particle
+	inline int GetAwakeGroupCount() const { return (awakeCount + 3) / 4; }
+
+	//The sphere a particle belongs to
+	inline Sphere* GetOwner(int i) const { return owners[i]; }
+
+	//Get methods
+	inline Vector3 GetPosition(int i) const { return Vector3(px[i], py[i], pz[i]); }
+	inline Vector3 GetLastPos(int i) const { return Vector3(lx[i], ly[i], lz[i]); }
+	inline Vector3 GetAccel(int i) const { return Vector3(ax[i], ay[i], az[i]); }
+	inline float GetDrag(int i) const { return drag[i]; }
+	inline float GetRest(int i) const { return rest[i]; }
+	inline bool GetAwake(int i) const { return i < awakeCount; }
+
+	//Set methods
+	inline void SetPosition(int i, const Vector3& p){ px[i] = p.x; py[i] = p.y; pz[i] = p.z; }
+	inline void SetLastPos(int i, const Vector3& p){ lx[i] = p.x; ly[i] = p.y; lz[i] = p.z; }
+	inline void SetAccel(int i, const Vector3& a){ ax[i] = a.x; ay[i] = a.y; az[i] = a.z; }
+
+	//Wakes or sleeps a particle, moving it across the boundary between the awake and
+	//sleeping particles. The particle and the one it swaps with change index, and their
+	//spheres are told. Awake particles are also flagged as a mask of all ones, so the
+	//integrator can use the flag as a mask directly. A particle woken during a step
+	//was not integrated, so it starts the step where it is woken.
+	inline void SetAwake(int i, bool a){
+		if (a && i >= awakeCount){
+			Swap(i, awakeCount);
+			SetStart(awakeCount, GetPosition(awakeCount));
+			awake[awakeCount++] = -1;
+		} else if (!a && i < awakeCount){
+			Swap(i, --awakeCount);
+			awake[awakeCount] = 0;
+		}
+	}
+
+protected:
+	//The number of particles in the store (not including the padding), and how
+	//many of them are awake
+	int count;
+	int awakeCount;
+
+	//Each component of each particle's state. The start is where the particle was
+	//before it was last integrated.
+	vector<float> px, py, pz;
+	vector<float> lx, ly, lz;
+	vector<float> sx, sy, sz;
+	vector<float> ax, ay, az;
+	vector<float> drag;
+	vector<float> rest;
+	vector<int> awake;
+
+	//The sphere each particle belongs to
+	vector<Sphere*> owners;
+
+	//Sets where a particle started the step
+	inline void SetStart(int i, const Vector3& p){ sx[i] = p.x; sy[i] = p.y; sz[i] = p.z; }
+
+	//Swaps two particles, telling their spheres their new indices
+	void Swap(int a, int b);
+
+	//Resizes every array to hold the supplied number of particles, plus padding
+	void Resize(int particles);
+
+private:
+	//Stores cannot be copied, as spheres refer to their particles by index
+	ParticleStore(const ParticleStore&);
+	ParticleStore& operator=(const ParticleStore&);
+};
@@ -6,6 +6,7 @@ class Plane
 {
 public:
 	friend class Verlet;
+	friend class PlaneSet;
 	
 	//Check whether a sphere has collided with this plane
 	inline bool Collided(const Sphere& s){
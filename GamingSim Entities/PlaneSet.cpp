@@ -0,0 +1,95 @@
+#include "PlaneSet.h"
+#include "Plane.h"
+#include <cfloat>
+#include <emmintrin.h>
+
+PlaneSet::PlaneSet(void)
+{
+}
+
+PlaneSet::~PlaneSet(void)
+{
+	for (unsigned int i=0; i<planes.size(); ++i){
+		delete planes[i];
+	}
+}
+
+void PlaneSet::Add(Plane* p){
+	int i = planes.size();
+	planes.push_back(p);
+
+	//Round up to a whole group of 4. A padding plane has no normal and is infinitely
+	//far away, so nothing is ever closer to it than its radius.
+	int padded = (planes.size() + 3) & ~3;
+
+	nx.resize(padded, 0.0f);
+	ny.resize(padded, 0.0f);
+	nz.resize(padded, 0.0f);
+	d.resize(padded, FLT_MAX);
+
+	nx[i] = p->normal.x;
+	ny[i] = p->normal.y;
+	nz[i] = p->normal.z;
+	d[i] = p->distance;
+}
+
+PlaneMask PlaneSet::Classify(const Vector3& low, const Vector3& high, float radius, PlaneMask candidates) const{
+	PlaneMask found = 0;
+	int count = GetCount() < MASK_BITS ? GetCount() : MASK_BITS;
+
+	for (int i=0; i<count; ++i){
+		if ((candidates & (static_cast<PlaneMask>(1) << i)) == 0) continue;
+
+		//The corner of the box furthest behind the plane is the closest any center
+		//in the box can get to colliding with it
+		float nearest = nx[i] * (nx[i] > 0.0f ? low.x : high.x) +
+			ny[i] * (ny[i] > 0.0f ? low.y : high.y) +
+			nz[i] * (nz[i] > 0.0f ? low.z : high.z) + d[i];
+
+		if (nearest < radius){
+			found |= static_cast<PlaneMask>(1) << i;
+		}
+	}
+
+	return found;
+}
+
+void PlaneSet::Collide(Sphere& s, PlaneMask mask, float msec) const{
+	int count = planes.size();
+
+	for (int g=0; g<count; g+=4){
+		//The planes of this group that need testing. Planes beyond the mask are
+		//always tested, and the padding never is.
+		int candidates = g < MASK_BITS ? static_cast<int>((mask >> g) & 0xF) : 0xF;
+		if (count - g < 4) candidates &= (1 << (count - g)) - 1;
+
+		if (candidates == 0) continue;
+
+		//Test the sphere against all 4 planes at once
+		Vector3 p = s.getPos();
+
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_loadu_ps(&nx[g]), _mm_set1_ps(p.x)),
+			_mm_mul_ps(_mm_loadu_ps(&ny[g]), _mm_set1_ps(p.y))),
+			_mm_mul_ps(_mm_loadu_ps(&nz[g]), _mm_set1_ps(p.z))),
+			_mm_loadu_ps(&d[g]));
+
+		int hits = _mm_movemask_ps(_mm_cmplt_ps(dot, _mm_set1_ps(s.getRadius())));
+
+		//Set once the sphere has been moved out of a plane, after which the tests
+		//already done for the rest of the group are out of date
+		bool resolved = false;
+
+		//Resolve the collisions in order, as the planes would be tested one at a time
+		for (int i=0; i<4; ++i){
+			if ((candidates & (1 << i)) == 0) continue;
+
+			Plane& plane = *planes[g + i];
+
+			if (resolved ? plane.Collided(s) : (hits & (1 << i)) != 0){
+				plane.ResolveCollision(s, msec);
+				resolved = true;
+			}
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include "Vector3.h"
+
+class Plane;
+class Sphere;
+
+using std::vector;
+
+//A set of planes, one bit for each plane by its index in a PlaneSet
+typedef unsigned long long PlaneMask;
+
+//A mask holding every plane
+const PlaneMask ALL_PLANES = ~static_cast<PlaneMask>(0);
+
+/**
+* Holds the static planes of the world, along with a copy of each plane's normal and
+* distance stored as one array per component, so a sphere can be tested against 4
+* planes at once. The set owns its planes, and deletes them when it is destroyed.
+*
+* Broad phases work out which planes each sphere may be touching as a PlaneMask.
+* Only the first MASK_BITS planes fit in a mask, and any planes beyond them are
+* always tested.
+*/
+class PlaneSet
+{
+public:
+	//The number of planes a PlaneMask can hold
+	static const int MASK_BITS = 64;
+
+	PlaneSet(void);
+	~PlaneSet(void);
+
+	//Adds a plane to the set, which takes ownership of it
+	void Add(Plane* p);
+
+	//The number of planes in the set
+	inline int GetCount() const { return planes.size(); }
+
+	//Returns a plane by its index
+	inline Plane* Get(int i) const { return planes[i]; }
+
+	//Returns the planes out of the candidates that a sphere centered anywhere in the
+	//box from low to high, with a radius up to the one supplied, could collide with
+	PlaneMask Classify(const Vector3& low, const Vector3& high, float radius, PlaneMask candidates) const;
+
+	//Resolves the collisions of a sphere with the planes in the mask (and any beyond
+	//MASK_BITS), in the order the planes were added
+	void Collide(Sphere& s, PlaneMask mask, float msec) const;
+
+protected:
+	vector<Plane*> planes;
+
+	//The normal and distance of each plane, padded to a multiple of 4 with planes
+	//no sphere can collide with
+	vector<float> nx, ny, nz, d;
+
+private:
+	//Sets cannot be copied, as they own their planes
+	PlaneSet(const PlaneSet&);
+	PlaneSet& operator=(const PlaneSet&);
+};
@@ -1,39 +1,64 @@
 #pragma once
 
+#include <list>
+#include <vector>
 #include "Vector3.h"
 #include "SRenderer.h"
 #include "MeshManager.h"
 #include "ShaderManager.h"
 #include "TextureManager.h"
+#include "SphereJournal.h"
+#include "ParticleStore.h"
+
+class Sphere;
+struct OctNode;
+
+//Records one octree leaf a sphere is stored in, and where in the leaf's spheres it is,
+//so the sphere can be removed from the leaf without searching for it.
+struct LeafEntry {
+	OctNode* leaf;
+	int index;
+};
 
 class Sphere
 {
 public:
 
 	friend class Verlet;
+	friend class Octree;
+	friend class LinearOctree;
+	friend class SphereJournal;
+	friend class ParticleStore;
+	friend class Islands;
+	friend class ContactCache;
 
 	//Get Methods
-	inline float getX() const{ return position.x; }
-	inline float getY() const{ return position.y; }
-	inline float getZ() const{ return position.z; }
+	inline float getX() const{ return getPos().x; }
+	inline float getY() const{ return getPos().y; }
+	inline float getZ() const{ return getPos().z; }
 
-	inline Vector3 getPos() const{ return position; }
-	inline Vector3 getLastPos() const{ return lastPos; }
+	inline Vector3 getPos() const{ return particles->GetPosition(particle); }
+	inline Vector3 getLastPos() const{ return particles->GetLastPos(particle); }
 
 	inline float getRadius() const{ return radius; }
 
 	//Returns the current position - the last position all over time
 	//v = s/t
 	inline Vector3 getVelocity(const float& time) const{
-		return (this->position - this->lastPos) / time;
+		return (getPos() - getLastPos()) / time;
 	}
 
 	inline float getMass() const { return mass; }
 	inline float getElasticity() const{ return elasticity; }
 
-	//Update/Setting methods
-	inline void updateRadius(float &x) { radius = x; }
-	inline void translate(const Vector3& s){ position += s; lastPos += s; }
+	//Update/Setting methods. Every method that moves or resizes a sphere records
+	//it in the engine's journal, so the broad phase knows to update it.
+	inline void updateRadius(float &x) { radius = x; Changed(); }
+	inline void translate(const Vector3& s){
+		particles->SetPosition(particle, getPos() + s);
+		particles->SetLastPos(particle, getLastPos() + s);
+		Changed();
+	}
 
 	//NOTE, All methods below that alter the physics properties of a sphere
 	//also wake the spheres, and change its texture to green.
@@ -41,30 +66,47 @@ public:
 	//Sets the spheres velocity by moving its previous position back
 	//by veloctiy * time. (s = v*t)
 	inline void setVelocity(const Vector3& v, const float& time){
-		awake = true;
+		particles->SetAwake(particle, true);
 		ro->SetTexture(TextureManager::Instance().GetTexture("green.png"));
 
-		this->lastPos = position - (v * time);
+		particles->SetLastPos(particle, getPos() - (v * time));
+		Changed();
 	}
 
 	//Sets the acceleration on an sphere (remains constant)
 	inline void setAcceleration(const Vector3& a){
-		awake = true;
+		particles->SetAwake(particle, true);
 		ro->SetTexture(TextureManager::Instance().GetTexture("green.png"));
-		accel = a;
+		particles->SetAccel(particle, a);
+		Changed();
 	}
 
 	//Applies a force to an sphere
 	inline void applyForce(const Vector3& n){
-		awake = true;
+		particles->SetAwake(particle, true);
+		ro->SetTexture(TextureManager::Instance().GetTexture("green.png"));
+		particles->SetAccel(particle, particles->GetAccel(particle) + n / mass);
+		Changed();
+	}
+
+	//Applies an impulse to a sphere, changing its velocity by impulse / mass. Used by
+	//the collision solver on spheres it has already woken.
+	inline void applyImpulse(const Vector3& j, const float& time){
+		particles->SetLastPos(particle, getLastPos() - (j * (time / mass)));
+		Changed();
+	}
+
+	//Wakes a sphere without changing its motion
+	inline void wake(){
+		particles->SetAwake(particle, true);
 		ro->SetTexture(TextureManager::Instance().GetTexture("green.png"));
-		accel += n / mass;
+		Changed();
 	}
 
 	//Assignment operator
 	inline Sphere operator=(const Sphere& rhs){
-		position = rhs.position;
-		lastPos = rhs.lastPos;
+		particles->SetPosition(particle, rhs.getPos());
+		particles->SetLastPos(particle, rhs.getLastPos());
 		radius = rhs.radius;
 		mass = rhs.mass;
 
@@ -74,21 +116,18 @@ public:
 	//Checks if two spheres are colliding.
 	bool CheckCollision(const Sphere& rhs) const {
 		float r = this->radius + rhs.radius;
-		float b = this->position.GetDistanceNSq(rhs.position);
+		float b = getPos().GetDistanceNSq(rhs.getPos());
 		return (b < (r*r));
 	}
 
-	//Resolves a collision between two spheres
-	void ResolveCollision(Sphere& rhs, const float& time);
-
 	//Returns whether or not this shape is awake
 	inline bool getAwake(){
-		return awake;
+		return particles->GetAwake(particle);
 	}
 
 	//Prints the contents of a sphere to console.
 	virtual inline void print(std::ostream& where) const{
-		where << "Sphere: \nposition: " << position << "\nRadius: " << radius;
+		where << "Sphere: \nposition: " << getPos() << "\nRadius: " << radius;
 	}
 
 	//OStream method
@@ -99,7 +138,7 @@ public:
 
 	//Given a renderer draws this sphere
 	inline void Draw(SRenderer& r){
-		ro->SetModelMatrix(Matrix4::Translation(position) *
+		ro->SetModelMatrix(Matrix4::Translation(getPos()) *
 			Matrix4::Scale(Vector3(radius, radius, radius)));
 		ro->Update(0.0f);
 		r.Render(*ro);
@@ -109,18 +148,56 @@ protected:
 	//Protected (con/de)structors as spheres should not be constructed outside
 	//the verlet physics engine
 	Sphere(void){ };
-	Sphere(const Vector3& position, const float& radius, const float& mass, float drag = 1.0f, float elasticty = 0.3f);
-	~Sphere(void){ delete ro; }
+	Sphere(ParticleStore& particles, const Vector3& position, const float& radius, const float& mass, float drag = 1.0f, float elasticty = 0.3f);
 
-	//Physics properties
-	Vector3 position, lastPos, accel;
-	float mass, drag, elasticity, radius;
+	//Spheres release their particle when they are deleted
+	~Sphere(void){ particles->Remove(particle); delete ro; }
 
-	//Used to reduce the number of collisions checks necessary.
-	bool awake;
+	//Records the sphere in the journal, if it belongs to an engine
+	inline void Changed(){
+		if (journal != NULL) journal->Record(*this);
+	}
+
+	//Physics properties. The position, last position, acceleration, drag and
+	//whether the sphere is awake are held by its particle.
+	float mass, elasticity, radius;
+
+	//The store holding the sphere's particle, and the index of the particle in it
+	ParticleStore* particles;
+	int particle;
 
 	//A Render object to make drawing of this object simple
 	RenderObject* ro;
 
+	//Where the sphere is stored in the physics engine's list of spheres
+	std::list<Sphere*>::iterator engineEntry;
+
+	//Where the sphere is stored in its broad phase's list of spheres
+	int broadPhaseIndex;
+
+	//Every octree leaf the sphere is stored in
+	std::vector<LeafEntry> leaves;
+
+	//The bounds the sphere is stored in the octree by. The sphere only needs
+	//moving in the octree once it escapes them.
+	Vector3 fatPos;
+	float fatRadius;
+
+	//Whether the octree nodes the sphere is stored in count it as awake. Brought up
+	//to date when the octree is updated with the sphere's changes.
+	bool countedAwake;
+
+	//The next sphere of the island the sphere was put to sleep with. The spheres of a
+	//sleeping island form a ring, so waking any of them wakes them all. NULL while
+	//the sphere is awake.
+	Sphere* nextAsleep;
+
+	//The journal the sphere records its changes in, and where it is in the
+	//journal: the worker whose list it is in, and its index in that list (-1 if it
+	//has not changed since the journal was last cleared)
+	SphereJournal* journal;
+	int journalWorker;
+	int journalIndex;
+
 };
 
@@ -0,0 +1,82 @@
+#include "SphereJournal.h"
+#include "Sphere.h"
+#include "ThreadPool.h"
+#include "Morton.h"
+
+SphereJournal::SphereJournal(int workerCount)
+	: lists(workerCount < 1 ? 1 : workerCount)
+{
+}
+
+void SphereJournal::Record(Sphere& s){
+	if (s.journalIndex >= 0) return;
+
+	int worker = ThreadPool::CurrentWorker();
+	vector<Sphere*>& changed = lists[worker];
+
+	s.journalWorker = worker;
+	s.journalIndex = changed.size();
+	changed.push_back(&s);
+}
+
+void SphereJournal::Forget(Sphere& s){
+	if (s.journalIndex < 0) return;
+
+	//Swap the last sphere of the same list into its place
+	vector<Sphere*>& changed = lists[s.journalWorker];
+
+	Sphere* last = changed.back();
+	changed[s.journalIndex] = last;
+	last->journalIndex = s.journalIndex;
+	changed.pop_back();
+
+	s.journalIndex = -1;
+}
+
+void SphereJournal::Clear(){
+	for (unsigned int i=0; i<lists.size(); ++i){
+		for (unsigned int j=0; j<lists[i].size(); ++j){
+			lists[i][j]->journalIndex = -1;
+		}
+
+		lists[i].clear();
+	}
+}
+
+const vector<Sphere*>& SphereJournal::Changed(){
+	vector<Sphere*>& changed = lists[0];
+
+	for (unsigned int i=1; i<lists.size(); ++i){
+		changed.insert(changed.end(), lists[i].begin(), lists[i].end());
+		lists[i].clear();
+	}
+
+	//Which worker recorded which sphere depends on how the work was shared out, so the
+	//spheres are put into particle order to give the same result on any number of threads
+	keys.resize(changed.size());
+	int highest = 0;
+
+	for (unsigned int i=0; i<changed.size(); ++i){
+		keys[i].code = changed[i]->particle;
+		keys[i].index = i;
+
+		if (changed[i]->particle > highest) highest = changed[i]->particle;
+	}
+
+	int bits = 0;
+	while ((highest >> bits) != 0) bits++;
+
+	Morton::RadixSort(keys, scratch, bits);
+
+	sorted.resize(changed.size());
+
+	for (unsigned int i=0; i<keys.size(); ++i){
+		sorted[i] = changed[keys[i].index];
+		sorted[i]->journalWorker = 0;
+		sorted[i]->journalIndex = i;
+	}
+
+	changed.swap(sorted);
+
+	return changed;
+}
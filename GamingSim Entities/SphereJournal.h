@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include "Morton.h"
+
+class Sphere;
+
+using std::vector;
+
+/**
+* A record of every sphere whose position or size has changed since the broad
+* phase last looked. The mutators of a sphere and the integrator add spheres to the
+* journal, so the broad phase only has to visit the spheres that have moved rather
+* than search the whole tree for them. Each sphere is recorded at most once.
+*
+* Each worker of the engine's thread pool records into its own list, so spheres can
+* be changed from several threads at once, as long as no sphere is changed by two
+* threads at the same time.
+*/
+class SphereJournal
+{
+public:
+	//Creates a journal with a list for each of the supplied number of workers
+	SphereJournal(int workerCount = 1);
+
+	//Adds a sphere to the calling worker's list, if it is not already in the journal
+	void Record(Sphere& s);
+
+	//Takes a sphere out of the journal, if it is in it. Used when a sphere is destroyed.
+	void Forget(Sphere& s);
+
+	//Empties the journal, ready to record the next changes
+	void Clear();
+
+	//Every sphere changed since the journal was last cleared, in the order of their
+	//particles. Moves every worker's list into the first, so must not be called
+	//while spheres are being changed.
+	const vector<Sphere*>& Changed();
+
+protected:
+	//The spheres recorded by each worker. Kept between frames so their memory is reused.
+	vector<vector<Sphere*>> lists;
+
+	//Used to sort the changed spheres into particle order
+	vector<Morton::Key> keys;
+	vector<Morton::Key> scratch;
+	vector<Sphere*> sorted;
+};
@@ -0,0 +1,123 @@
+#include "StaticTree.h"
+#include "Box.h"
+#include <algorithm>
+
+StaticTree::StaticTree(void)
+{
+	built = true;
+}
+
+StaticTree::~StaticTree(void)
+{
+	for (unsigned int i=0; i<boxes.size(); ++i){
+		delete boxes[i];
+	}
+}
+
+void StaticTree::Add(Box* b){
+	boxes.push_back(b);
+	built = false;
+}
+
+void StaticTree::Build(){
+	nodes.clear();
+
+	if (!boxes.empty()){
+		//Halving never leaves fewer than 2 boxes in a leaf, and a tree with n
+		//leaves has 2n - 1 nodes
+		nodes.reserve(boxes.size());
+		BuildNode(0, boxes.size());
+	}
+
+	built = true;
+}
+
+void StaticTree::BuildNode(int begin, int end){
+	int index = nodes.size();
+	nodes.push_back(Node());
+
+	//Find the bounds of the boxes, and of their centers
+	Vector3 low = boxes[begin]->low, high = boxes[begin]->high;
+	Vector3 centerLow = (low + high) * 0.5f, centerHigh = centerLow;
+
+	for (int i = begin + 1; i < end; ++i){
+		Box& b = *boxes[i];
+		Vector3 center = (b.low + b.high) * 0.5f;
+
+		low = Vector3(min(low.x, b.low.x), min(low.y, b.low.y), min(low.z, b.low.z));
+		high = Vector3(max(high.x, b.high.x), max(high.y, b.high.y), max(high.z, b.high.z));
+		centerLow = Vector3(min(centerLow.x, center.x), min(centerLow.y, center.y), min(centerLow.z, center.z));
+		centerHigh = Vector3(max(centerHigh.x, center.x), max(centerHigh.y, center.y), max(centerHigh.z, center.z));
+	}
+
+	nodes[index].low = low;
+	nodes[index].high = high;
+
+	if (end - begin <= LEAF_SIZE){
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return;
+	}
+
+	//Split the boxes in half along the longest axis of their centers
+	Vector3 extent = centerHigh - centerLow;
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > (axis == 0 ? extent.x : extent.y)) axis = 2;
+
+	int middle = begin + (end - begin) / 2;
+
+	std::nth_element(boxes.begin() + begin, boxes.begin() + middle, boxes.begin() + end, [axis](const Box* a, const Box* b){
+		switch (axis){
+		case 0: return a->low.x + a->high.x < b->low.x + b->high.x;
+		case 1: return a->low.y + a->high.y < b->low.y + b->high.y;
+		default: return a->low.z + a->high.z < b->low.z + b->high.z;
+		}
+	});
+
+	//The first child follows this node, and the second follows the first's subtree
+	BuildNode(begin, middle);
+
+	nodes[index].first = nodes.size();
+	nodes[index].count = 0;
+
+	BuildNode(middle, end);
+}
+
+void StaticTree::Collide(Sphere& s, float msec) const{
+	if (nodes.empty()) return;
+
+	Vector3 p = s.getPos();
+	float r = s.getRadius();
+
+	//The tree is balanced, so its depth is never more than the bits in its size
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0){
+		const Node& node = nodes[stack[--top]];
+
+		//Skip any node the bounding box of the sphere does not touch
+		if (p.x + r < node.low.x || p.x - r > node.high.x ||
+			p.y + r < node.low.y || p.y - r > node.high.y ||
+			p.z + r < node.low.z || p.z - r > node.high.z){
+			continue;
+		}
+
+		if (node.count == 0){
+			//Visit the first child before the second
+			stack[top++] = node.first;
+			stack[top++] = &node - &nodes[0] + 1;
+			continue;
+		}
+
+		for (int i = node.first; i < node.first + node.count; ++i){
+			Box& b = *boxes[i];
+
+			if (b.Collided(s)){
+				b.ResolveCollision(s, msec);
+			}
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include "Vector3.h"
+
+class Box;
+class Sphere;
+
+using std::vector;
+
+/**
+* A bounding volume hierarchy over the static boxes of the world. The tree is built
+* once every box has been added, and is never touched by the octree's updates, so a
+* sphere finds the boxes it may be touching with a descent of O(log n) nodes however
+* many boxes the world is made of.
+*
+* The nodes are stored depth first in one array: a node's first child directly
+* follows it, and it records where its second child is. The set owns its boxes,
+* and deletes them when it is destroyed.
+*/
+class StaticTree
+{
+public:
+	//The most boxes kept in a leaf
+	static const int LEAF_SIZE = 4;
+
+	StaticTree(void);
+	~StaticTree(void);
+
+	//Adds a box to the tree, which takes ownership of it. The tree must be built
+	//again before it is next queried.
+	void Add(Box* b);
+
+	//Builds the tree over every box added so far, splitting the boxes in half by
+	//their centers along the longest axis of each node
+	void Build();
+
+	//Whether the tree has been built since the last box was added
+	inline bool IsBuilt() const { return built; }
+
+	//The number of boxes in the tree
+	inline int GetCount() const { return boxes.size(); }
+
+	//Returns a box by its index, in the order the boxes are stored in the leaves
+	inline Box* Get(int i) const { return boxes[i]; }
+
+	//The number of nodes in the built tree
+	inline int GetNodeCount() const { return nodes.size(); }
+
+	//Resolves the collisions of a sphere with every box it has collided with. Only
+	//the nodes the bounds of the sphere overlap are visited.
+	void Collide(Sphere& s, float msec) const;
+
+protected:
+	struct Node {
+		//The bounds of every box beneath the node
+		Vector3 low;
+		Vector3 high;
+
+		//For a leaf, the range of boxes it holds, otherwise count is 0 and first is
+		//the index of the node's second child
+		int first;
+		int count;
+	};
+
+	//Builds the node holding the boxes in [begin, end), and the nodes beneath it.
+	//The boxes are always split in half, so the tree is balanced.
+	void BuildNode(int begin, int end);
+
+	vector<Box*> boxes;
+	vector<Node> nodes;
+
+	bool built;
+
+private:
+	//Trees cannot be copied, as they own their boxes
+	StaticTree(const StaticTree&);
+	StaticTree& operator=(const StaticTree&);
+};
@@ -0,0 +1,117 @@
+#include "ThreadPool.h"
+
+//The index of the worker running on this thread
+static THREAD_LOCAL int currentWorker = 0;
+
+int ThreadPool::CurrentWorker(){
+	return currentWorker;
+}
+
+ThreadPool::ThreadPool(int workers)
+{
+	if (workers <= 0){
+		workers = std::thread::hardware_concurrency();
+
+		//hardware_concurrency is allowed to return 0 if it cannot tell
+		if (workers <= 0) workers = 1;
+	}
+
+	job = NULL;
+	count = 0;
+	chunkSize = 1;
+	nextChunk = 0;
+	generation = 0;
+	busy = 0;
+	stopping = false;
+
+	//The calling thread is always worker 0, so only the others need threads
+	for (int i=1; i<workers; ++i){
+		threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (unsigned int i=0; i<threads.size(); ++i){
+		threads[i].join();
+	}
+}
+
+void ThreadPool::ParallelFor(int count, const Job& job){
+	if (count <= 0) return;
+
+	//Not worth waking anyone for a single chunk
+	if (threads.empty() || count == 1){
+		job(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(lock);
+		this->job = &job;
+		this->count = count;
+
+		//Several chunks per worker, so a slow chunk does not hold everyone else up
+		chunkSize = count / (GetWorkerCount() * 4);
+		if (chunkSize < 1) chunkSize = 1;
+
+		nextChunk = 0;
+		busy = threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	//This thread works too
+	RunChunks(0);
+
+	//Then waits for the others to finish their last chunks
+	std::unique_lock<std::mutex> l(lock);
+	while (busy > 0){
+		finished.wait(l);
+	}
+	this->job = NULL;
+}
+
+void ThreadPool::WorkerLoop(int worker){
+	int seen = 0;
+	currentWorker = worker;
+
+	while (true){
+		{
+			std::unique_lock<std::mutex> l(lock);
+			while (!stopping && generation == seen){
+				wake.wait(l);
+			}
+
+			if (stopping) return;
+
+			seen = generation;
+		}
+
+		RunChunks(worker);
+
+		{
+			std::lock_guard<std::mutex> l(lock);
+			busy--;
+			if (busy == 0) finished.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunChunks(int worker){
+	while (true){
+		int begin = nextChunk.fetch_add(chunkSize);
+		if (begin >= count) return;
+
+		int end = begin + chunkSize;
+		if (end > count) end = count;
+
+		(*job)(begin, end, worker);
+	}
+}
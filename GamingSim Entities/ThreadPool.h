@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using std::vector;
+
+//Storage local to each thread. VS2012 does not support thread_local.
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/**
+* A fixed set of worker threads used to split loops over the physics engine's data.
+* The thread that calls ParallelFor always takes part as worker 0, so a pool of one
+* thread runs everything inline with no synchronisation at all.
+*/
+class ThreadPool
+{
+public:
+	//A job is handed a range [begin, end) of the loop, and the index of the worker
+	//running it. Worker indices are always below GetWorkerCount().
+	typedef std::function<void(int begin, int end, int worker)> Job;
+
+	//Creates a pool with the supplied number of workers (including the calling
+	//thread). 0 uses one worker per hardware thread.
+	ThreadPool(int workers = 0);
+	~ThreadPool(void);
+
+	//Returns the number of workers, including the calling thread
+	inline int GetWorkerCount() const { return threads.size() + 1; }
+
+	//Returns the index of the worker running on the calling thread. Any thread that
+	//is not one of a pool's worker threads is worker 0.
+	static int CurrentWorker();
+
+	//Runs the job over the range [0, count), split into chunks shared out between the
+	//workers. Returns once every chunk has been run.
+	void ParallelFor(int count, const Job& job);
+
+protected:
+	//The loop each worker thread sits in, waiting for jobs
+	void WorkerLoop(int worker);
+
+	//Takes chunks of the current job until there are none left
+	void RunChunks(int worker);
+
+	vector<std::thread> threads;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+
+	//The job being run, and how it is split up
+	const Job* job;
+	int count;
+	int chunkSize;
+	std::atomic<int> nextChunk;
+
+	//Incremented every time a job is started, so workers know there is new work
+	int generation;
+
+	//The number of worker threads still running the current job
+	int busy;
+
+	//Set when the pool is destroyed, to release the workers
+	bool stopping;
+
+private:
+	//Pools cannot be copied, as they own their threads
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+};
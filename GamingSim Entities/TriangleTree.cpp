@@ -0,0 +1,445 @@
+#include "TriangleTree.h"
+#include "Sphere.h"
+#include "MeshManager.h"
+#include "ShaderManager.h"
+#include "TextureManager.h"
+#include "SRenderer.h"
+#include <algorithm>
+#include <emmintrin.h>
+
+//The number of bins the centers of a node's triangles are sorted into along each
+//axis, when looking for the cheapest split
+static const int SPLIT_BINS = 12;
+
+//Returns the surface area of a box, which the chance of a sphere touching it is
+//roughly proportional to
+static inline float SurfaceArea(const Vector3& low, const Vector3& high){
+	float x = high.x - low.x, y = high.y - low.y, z = high.z - low.z;
+	return 2.0f * (x * y + y * z + z * x);
+}
+
+//Grows a box to take in another
+static inline void Enclose(Vector3& low, Vector3& high, const Vector3& otherLow, const Vector3& otherHigh){
+	low = Vector3(min(low.x, otherLow.x), min(low.y, otherLow.y), min(low.z, otherLow.z));
+	high = Vector3(max(high.x, otherHigh.x), max(high.y, otherHigh.y), max(high.z, otherHigh.z));
+}
+
+TriangleTree::TriangleTree(void)
+{
+	built = true;
+}
+
+TriangleTree::~TriangleTree(void)
+{
+	while (!objects.empty()){
+		delete objects.back();
+		objects.pop_back();
+	}
+}
+
+void TriangleTree::Add(Mesh* mesh, const Matrix4& transform){
+	const vector<Vector3>& triangles = mesh->GetTriangles();
+
+	int first = corners.size();
+	corners.resize(first + triangles.size());
+
+	if (!triangles.empty()){
+		transform.Transform(&triangles[0], &corners[first], triangles.size());
+	}
+
+	//Meshes used as colliders are drawn green, like the boxes
+	RenderObject* ro = new RenderObject(mesh, ShaderManager::Instance().GetShader("basic"), TextureManager::Instance().GetTexture("green.png"));
+	ro->SetModelMatrix(transform);
+	ro->Update(0.0f);
+	objects.push_back(ro);
+
+	built = false;
+}
+
+void TriangleTree::Build(){
+	int count = GetCount();
+
+	nodes.clear();
+	groups.clear();
+
+	order.resize(count);
+	lows.resize(count);
+	highs.resize(count);
+	centers.resize(count);
+
+	for (int i=0; i<count; ++i){
+		Vector3 a = corners[i * 3], b = corners[i * 3 + 1], c = corners[i * 3 + 2];
+
+		order[i] = i;
+		lows[i] = Vector3(min(a.x, min(b.x, c.x)), min(a.y, min(b.y, c.y)), min(a.z, min(b.z, c.z)));
+		highs[i] = Vector3(max(a.x, max(b.x, c.x)), max(a.y, max(b.y, c.y)), max(a.z, max(b.z, c.z)));
+		centers[i] = (lows[i] + highs[i]) * 0.5f;
+	}
+
+	if (count > 0){
+		BuildNode(0, count, 0);
+	}
+
+	//The build data is not needed until more meshes are added
+	vector<int>().swap(order);
+	vector<Vector3>().swap(lows);
+	vector<Vector3>().swap(highs);
+	vector<Vector3>().swap(centers);
+
+	built = true;
+}
+
+void TriangleTree::BuildNode(int begin, int end, int depth){
+	int index = nodes.size();
+	nodes.push_back(Node());
+
+	//Find the bounds of the triangles, and of their centers
+	Vector3 low = lows[order[begin]], high = highs[order[begin]];
+	Vector3 centerLow = centers[order[begin]], centerHigh = centerLow;
+
+	for (int i = begin + 1; i < end; ++i){
+		Enclose(low, high, lows[order[i]], highs[order[i]]);
+		Enclose(centerLow, centerHigh, centers[order[i]], centers[order[i]]);
+	}
+
+	nodes[index].low = low;
+	nodes[index].high = high;
+
+	int count = end - begin;
+
+	//Look for the cheapest split, sorting the triangles into bins by their centers
+	//along each axis in turn and trying a split between each pair of bins
+	int bestAxis = -1, bestBin = 0;
+	float bestCost = SurfaceArea(low, high) * count;
+
+	if (count > 4 && depth < MAX_SAH_DEPTH){
+		for (int axis=0; axis<3; ++axis){
+			float from = axis == 0 ? centerLow.x : (axis == 1 ? centerLow.y : centerLow.z);
+			float to = axis == 0 ? centerHigh.x : (axis == 1 ? centerHigh.y : centerHigh.z);
+
+			if (to <= from) continue;
+
+			float scale = SPLIT_BINS / (to - from);
+
+			int binCounts[SPLIT_BINS] = { 0 };
+			Vector3 binLows[SPLIT_BINS], binHighs[SPLIT_BINS];
+
+			for (int i = begin; i < end; ++i){
+				int t = order[i];
+				float c = axis == 0 ? centers[t].x : (axis == 1 ? centers[t].y : centers[t].z);
+				int bin = min(static_cast<int>((c - from) * scale), SPLIT_BINS - 1);
+
+				if (binCounts[bin]++ == 0){
+					binLows[bin] = lows[t];
+					binHighs[bin] = highs[t];
+				} else {
+					Enclose(binLows[bin], binHighs[bin], lows[t], highs[t]);
+				}
+			}
+
+			//Sweep from the right, recording the cost of everything right of each split
+			float rightCosts[SPLIT_BINS];
+			int rightCount = 0;
+			Vector3 rightLow, rightHigh;
+
+			for (int bin = SPLIT_BINS - 1; bin > 0; --bin){
+				if (binCounts[bin] > 0){
+					if (rightCount == 0){
+						rightLow = binLows[bin];
+						rightHigh = binHighs[bin];
+					} else {
+						Enclose(rightLow, rightHigh, binLows[bin], binHighs[bin]);
+					}
+					rightCount += binCounts[bin];
+				}
+				rightCosts[bin] = rightCount > 0 ? SurfaceArea(rightLow, rightHigh) * rightCount : 0.0f;
+			}
+
+			//Then sweep from the left, adding the cost of everything left of each split
+			int leftCount = 0;
+			Vector3 leftLow, leftHigh;
+
+			for (int bin = 0; bin < SPLIT_BINS - 1; ++bin){
+				if (binCounts[bin] > 0){
+					if (leftCount == 0){
+						leftLow = binLows[bin];
+						leftHigh = binHighs[bin];
+					} else {
+						Enclose(leftLow, leftHigh, binLows[bin], binHighs[bin]);
+					}
+					leftCount += binCounts[bin];
+				}
+
+				if (leftCount == 0 || leftCount == count) continue;
+
+				float cost = SurfaceArea(leftLow, leftHigh) * leftCount + rightCosts[bin + 1];
+
+				if (cost < bestCost){
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = bin;
+				}
+			}
+		}
+	}
+
+	int middle = begin;
+
+	if (bestAxis >= 0){
+		//Move the triangles left of the split to the front of the range
+		float from = bestAxis == 0 ? centerLow.x : (bestAxis == 1 ? centerLow.y : centerLow.z);
+		float to = bestAxis == 0 ? centerHigh.x : (bestAxis == 1 ? centerHigh.y : centerHigh.z);
+		float scale = SPLIT_BINS / (to - from);
+		int axis = bestAxis, split = bestBin;
+		const vector<Vector3>& c = centers;
+
+		middle = std::partition(order.begin() + begin, order.begin() + end, [&](int t){
+			float v = axis == 0 ? c[t].x : (axis == 1 ? c[t].y : c[t].z);
+			return min(static_cast<int>((v - from) * scale), SPLIT_BINS - 1) <= split;
+		}) - order.begin();
+	} else if (count > LEAF_SIZE){
+		//No split is cheaper than a leaf (or the node is too deep to look for one), but
+		//the leaf would be too large, so split the triangles in half along the longest
+		//axis of their centers
+		Vector3 extent = centerHigh - centerLow;
+		int axis = 0;
+		if (extent.y > extent.x) axis = 1;
+		if (extent.z > (axis == 0 ? extent.x : extent.y)) axis = 2;
+
+		middle = begin + count / 2;
+		const vector<Vector3>& c = centers;
+
+		std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int a, int b){
+			return axis == 0 ? c[a].x < c[b].x : (axis == 1 ? c[a].y < c[b].y : c[a].z < c[b].z);
+		});
+	}
+
+	if (middle == begin || middle == end){
+		//A leaf, so pack its triangles into groups of 4. Unused lanes hold a point
+		//too far away for any sphere to reach.
+		nodes[index].first = groups.size();
+		nodes[index].count = (count + 3) / 4;
+
+		for (int i=0; i<count; i+=4){
+			Group g;
+
+			for (int lane=0; lane<4; ++lane){
+				Vector3 a(1e18f, 1e18f, 1e18f), ab(0, 0, 0), ac(0, 0, 0);
+
+				if (i + lane < count){
+					int t = order[begin + i + lane];
+					a = corners[t * 3];
+					ab = corners[t * 3 + 1] - a;
+					ac = corners[t * 3 + 2] - a;
+				}
+
+				g.ax[lane] = a.x; g.ay[lane] = a.y; g.az[lane] = a.z;
+				g.abx[lane] = ab.x; g.aby[lane] = ab.y; g.abz[lane] = ab.z;
+				g.acx[lane] = ac.x; g.acy[lane] = ac.y; g.acz[lane] = ac.z;
+			}
+
+			groups.push_back(g);
+		}
+		return;
+	}
+
+	//The first child follows this node, and the second follows the first's subtree
+	BuildNode(begin, middle, depth + 1);
+
+	nodes[index].first = nodes.size();
+	nodes[index].count = 0;
+
+	BuildNode(middle, end, depth + 1);
+}
+
+//Selects b where the mask is set, and a elsewhere
+static inline __m128 Select(__m128 a, __m128 b, __m128 mask){
+	return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+//Returns the dot product of 4 pairs of vectors
+static inline __m128 Dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz){
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+int TriangleTree::ClosestPoints(const Group& g, const Vector3& p, float radius, float* qx, float* qy, float* qz) const{
+	__m128 ax = _mm_loadu_ps(g.ax), ay = _mm_loadu_ps(g.ay), az = _mm_loadu_ps(g.az);
+	__m128 abx = _mm_loadu_ps(g.abx), aby = _mm_loadu_ps(g.aby), abz = _mm_loadu_ps(g.abz);
+	__m128 acx = _mm_loadu_ps(g.acx), acy = _mm_loadu_ps(g.acy), acz = _mm_loadu_ps(g.acz);
+
+	__m128 apx = _mm_sub_ps(_mm_set1_ps(p.x), ax);
+	__m128 apy = _mm_sub_ps(_mm_set1_ps(p.y), ay);
+	__m128 apz = _mm_sub_ps(_mm_set1_ps(p.z), az);
+
+	//The closest point is found by which of the triangle's regions (a corner, an edge
+	//or the face) the point lies in front of, as in Ericson's Real-Time Collision
+	//Detection. The point to corner b and c dot products follow from those to a.
+	__m128 abab = Dot(abx, aby, abz, abx, aby, abz);
+	__m128 abac = Dot(abx, aby, abz, acx, acy, acz);
+	__m128 acac = Dot(acx, acy, acz, acx, acy, acz);
+
+	__m128 d1 = Dot(abx, aby, abz, apx, apy, apz);
+	__m128 d2 = Dot(acx, acy, acz, apx, apy, apz);
+	__m128 d3 = _mm_sub_ps(d1, abab);
+	__m128 d4 = _mm_sub_ps(d2, abac);
+	__m128 d5 = _mm_sub_ps(d1, abac);
+	__m128 d6 = _mm_sub_ps(d2, acac);
+
+	__m128 va = _mm_sub_ps(_mm_mul_ps(d3, d6), _mm_mul_ps(d5, d4));
+	__m128 vb = _mm_sub_ps(_mm_mul_ps(d5, d2), _mm_mul_ps(d1, d6));
+	__m128 vc = _mm_sub_ps(_mm_mul_ps(d1, d4), _mm_mul_ps(d3, d2));
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+
+	//The closest point is a + ab * v + ac * w. Start with the face, then let each
+	//region overwrite it, the regions tested first overwriting last. Lanes that do
+	//not take a region may divide by zero, but their results are never selected.
+	__m128 denom = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(va, vb), vc));
+	__m128 v = _mm_mul_ps(vb, denom);
+	__m128 w = _mm_mul_ps(vc, denom);
+
+	//Edge bc
+	__m128 d43 = _mm_sub_ps(d4, d3);
+	__m128 d56 = _mm_sub_ps(d5, d6);
+	__m128 mask = _mm_and_ps(_mm_cmple_ps(va, zero), _mm_and_ps(_mm_cmpge_ps(d43, zero), _mm_cmpge_ps(d56, zero)));
+	__m128 t = _mm_div_ps(d43, _mm_add_ps(d43, d56));
+	v = Select(v, _mm_sub_ps(one, t), mask);
+	w = Select(w, t, mask);
+
+	//Edge ac
+	mask = _mm_and_ps(_mm_cmple_ps(vb, zero), _mm_and_ps(_mm_cmpge_ps(d2, zero), _mm_cmple_ps(d6, zero)));
+	v = Select(v, zero, mask);
+	w = Select(w, _mm_div_ps(d2, _mm_sub_ps(d2, d6)), mask);
+
+	//Corner c
+	mask = _mm_and_ps(_mm_cmpge_ps(d6, zero), _mm_cmple_ps(d5, d6));
+	v = Select(v, zero, mask);
+	w = Select(w, one, mask);
+
+	//Edge ab
+	mask = _mm_and_ps(_mm_cmple_ps(vc, zero), _mm_and_ps(_mm_cmpge_ps(d1, zero), _mm_cmple_ps(d3, zero)));
+	v = Select(v, _mm_div_ps(d1, _mm_sub_ps(d1, d3)), mask);
+	w = Select(w, zero, mask);
+
+	//Corner b
+	mask = _mm_and_ps(_mm_cmpge_ps(d3, zero), _mm_cmple_ps(d4, d3));
+	v = Select(v, one, mask);
+	w = Select(w, zero, mask);
+
+	//Corner a
+	mask = _mm_and_ps(_mm_cmple_ps(d1, zero), _mm_cmple_ps(d2, zero));
+	v = Select(v, zero, mask);
+	w = Select(w, zero, mask);
+
+	__m128 cx = _mm_add_ps(ax, _mm_add_ps(_mm_mul_ps(abx, v), _mm_mul_ps(acx, w)));
+	__m128 cy = _mm_add_ps(ay, _mm_add_ps(_mm_mul_ps(aby, v), _mm_mul_ps(acy, w)));
+	__m128 cz = _mm_add_ps(az, _mm_add_ps(_mm_mul_ps(abz, v), _mm_mul_ps(acz, w)));
+
+	_mm_storeu_ps(qx, cx);
+	_mm_storeu_ps(qy, cy);
+	_mm_storeu_ps(qz, cz);
+
+	__m128 dx = _mm_sub_ps(_mm_set1_ps(p.x), cx);
+	__m128 dy = _mm_sub_ps(_mm_set1_ps(p.y), cy);
+	__m128 dz = _mm_sub_ps(_mm_set1_ps(p.z), cz);
+
+	return _mm_movemask_ps(_mm_cmplt_ps(Dot(dx, dy, dz, dx, dy, dz), _mm_set1_ps(radius * radius)));
+}
+
+void TriangleTree::Resolve(Sphere& s, const Group& g, int lane, const Vector3& closest, float msec) const{
+	Vector3 toCenter = s.getPos() - closest;
+	float distance = toCenter.GetMagnitude();
+
+	Vector3 normal;
+	float peneDepth;
+
+	if (distance > 1e-6f){
+		//Push the sphere away from the closest point
+		normal = toCenter / distance;
+		peneDepth = s.getRadius() - distance;
+	} else {
+		//The center of the sphere is on the triangle, so push it back out of the
+		//side it came from
+		Vector3 ab(g.abx[lane], g.aby[lane], g.abz[lane]);
+		Vector3 ac(g.acx[lane], g.acy[lane], g.acz[lane]);
+		Vector3 a(g.ax[lane], g.ay[lane], g.az[lane]);
+
+		normal = ab.CrossProduct(ac).GetNormalised();
+		if (normal.DotProduct(s.getLastPos() - a) < 0.0f){
+			normal = normal * -1.0f;
+		}
+		peneDepth = s.getRadius();
+	}
+
+	//Only the velocity into the triangle is reflected, as the mesh is immovable
+	Vector3 sVelo = s.getVelocity(msec);
+	float veloNormal = sVelo.DotProduct(normal);
+
+	if (veloNormal < 0.0f){
+		sVelo -= normal * ((1 + s.getElasticity()) * veloNormal);
+	}
+
+	//Translate the sphere out of collision first, then set its velocity
+	s.translate(normal * peneDepth);
+	s.setVelocity(sVelo, msec);
+}
+
+void TriangleTree::Collide(Sphere& s, float msec) const{
+	if (nodes.empty()) return;
+
+	//Each node pushes at most one more node than it pops, so the stack never holds
+	//more nodes than the tree is deep (see MAX_SAH_DEPTH)
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0){
+		const Node& node = nodes[stack[--top]];
+
+		//Skip any node the bounding box of the sphere does not touch
+		Vector3 p = s.getPos();
+		float r = s.getRadius();
+
+		if (p.x + r < node.low.x || p.x - r > node.high.x ||
+			p.y + r < node.low.y || p.y - r > node.high.y ||
+			p.z + r < node.low.z || p.z - r > node.high.z){
+			continue;
+		}
+
+		if (node.count == 0){
+			//Visit the first child before the second
+			stack[top++] = node.first;
+			stack[top++] = &node - &nodes[0] + 1;
+			continue;
+		}
+
+		for (int i = node.first; i < node.first + node.count; ++i){
+			const Group& g = groups[i];
+			int lane = 0;
+
+			//Resolve the triangles hit in order. Resolving one moves the sphere, so the
+			//rest of the group is tested again from its new position.
+			while (lane < 4){
+				float qx[4], qy[4], qz[4];
+				int hits = ClosestPoints(g, s.getPos(), s.getRadius(), qx, qy, qz) >> lane;
+
+				if (hits == 0) break;
+
+				while ((hits & 1) == 0){
+					hits >>= 1;
+					lane++;
+				}
+
+				Resolve(s, g, lane, Vector3(qx[lane], qy[lane], qz[lane]), msec);
+				lane++;
+			}
+		}
+	}
+}
+
+void TriangleTree::Draw(SRenderer& r){
+	for (list<RenderObject*>::const_iterator i = objects.begin(); i != objects.end(); ++i){
+		r.Render(**i);
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include "Vector3.h"
+#include "Matrix4.h"
+
+class Mesh;
+class Sphere;
+class RenderObject;
+class SRenderer;
+
+using std::vector;
+using std::list;
+
+/**
+* A bounding volume hierarchy over the triangles of the static meshes spheres
+* collide with. Meshes are added with the transform that places them in the world,
+* and the tree is built over every triangle once they have been added.
+*
+* Nodes are split where the surface area heuristic says testing the two halves is
+* cheapest. The triangles of each leaf are packed into groups of 4, stored as one
+* array per component, so a sphere is tested against 4 triangles at once. The nodes
+* are stored depth first in one array, as in StaticTree.
+*/
+class TriangleTree
+{
+public:
+	//The most triangles kept in a leaf
+	static const int LEAF_SIZE = 8;
+
+	//The deepest a node may be split by the surface area heuristic. Nodes beneath it
+	//are split in half, so the depth of the tree stays within the query stack.
+	static const int MAX_SAH_DEPTH = 32;
+
+	TriangleTree(void);
+	~TriangleTree(void);
+
+	//Adds the triangles of a mesh, placed in the world by the supplied transform. The
+	//mesh must have been loaded with its triangles kept. The tree must be built
+	//again before it is next queried.
+	void Add(Mesh* mesh, const Matrix4& transform);
+
+	//Builds the tree over every triangle added so far
+	void Build();
+
+	//Whether the tree has been built since the last mesh was added
+	inline bool IsBuilt() const { return built; }
+
+	//The number of triangles in the tree
+	inline int GetCount() const { return corners.size() / 3; }
+
+	//The number of nodes in the built tree
+	inline int GetNodeCount() const { return nodes.size(); }
+
+	//Resolves the collisions of a sphere with every triangle it has collided with.
+	//Only the nodes the bounds of the sphere overlap are visited.
+	void Collide(Sphere& s, float msec) const;
+
+	//Draws every mesh added to the tree
+	void Draw(SRenderer& r);
+
+protected:
+	struct Node {
+		//The bounds of every triangle beneath the node
+		Vector3 low;
+		Vector3 high;
+
+		//For a leaf, the range of groups it holds, otherwise count is 0 and first is
+		//the index of the node's second child
+		int first;
+		int count;
+	};
+
+	//4 triangles, each stored as a corner and the edges from it to the other two
+	struct Group {
+		float ax[4], ay[4], az[4];
+		float abx[4], aby[4], abz[4];
+		float acx[4], acy[4], acz[4];
+	};
+
+	//Builds the node at the supplied depth holding the triangles in [begin, end)
+	//of the build order
+	void BuildNode(int begin, int end, int depth);
+
+	//Finds the closest point on each triangle of a group to a point, and the squared
+	//distance to it. Returns a mask of the triangles closer than the radius.
+	int ClosestPoints(const Group& g, const Vector3& p, float radius, float* qx, float* qy, float* qz) const;
+
+	//Resolves a collision between a sphere and the point on a triangle closest to it
+	void Resolve(Sphere& s, const Group& g, int lane, const Vector3& closest, float msec) const;
+
+	//The corners of every triangle added, three at a time, in world space
+	vector<Vector3> corners;
+
+	//The order the triangles are placed in the leaves, and each triangle's bounds
+	//and center. Only used while building.
+	vector<int> order;
+	vector<Vector3> lows, highs, centers;
+
+	vector<Node> nodes;
+	vector<Group> groups;
+
+	bool built;
+
+	//A render object for each mesh added
+	list<RenderObject*> objects;
+
+private:
+	//Trees cannot be copied, as they own their render objects
+	TriangleTree(const TriangleTree&);
+	TriangleTree& operator=(const TriangleTree&);
+};
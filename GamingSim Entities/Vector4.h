@@ -24,8 +24,6 @@ public:
 		this->w = w;
 	}
 
-	~Vector4(void){}
-
 	float x;
 	float y;
 	float z;
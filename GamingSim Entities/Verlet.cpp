@@ -1,10 +1,22 @@
 #include "Verlet.h"
 
 
-Verlet::Verlet(Vector3 worldSize, int threshold, int maxDepth)
+Verlet::Verlet(Vector3 worldSize, int threshold, int maxDepth, BroadPhaseType broadPhase, float looseness, int threads)
 {
+	//Create the supplied number of workers, or one for every hardware thread
+	workers = new ThreadPool(threads);
+
+	//Each worker records the spheres it changes, and the particles it moves, separately
+	journal = new SphereJournal(workers->GetWorkerCount());
+	moved.resize(workers->GetWorkerCount());
+
 	//Create the octree this physics engine will use.
-	o = new Octree(worldSize, threshold, maxDepth);
+	if (broadPhase == LINEAR_OCTREE){
+		//The linear octree places spheres by size, so has no use for a threshold
+		o = new LinearOctree(worldSize, maxDepth, workers);
+	} else {
+		o = new Octree(worldSize, threshold, maxDepth, workers, looseness);
+	}
 }
 
 
@@ -19,9 +31,8 @@ Verlet::~Verlet(void)
 		spheres.pop_back();
 	}
 
-	//Delete all the planes
-	while (!(planes.empty())){
-		delete planes.back();
-		planes.pop_back();
-	}
+	//Delete the broad phase, then the threads it used
+	delete o;
+	delete journal;
+	delete workers;
 }
@@ -3,66 +3,111 @@
 #include "Sphere.h"
 #include <list>
 #include "Octree.h"
+#include "LinearOctree.h"
+#include "ThreadPool.h"
 #include "Plane.h"
+#include "PlaneSet.h"
+#include "Box.h"
+#include "StaticTree.h"
+#include "TriangleTree.h"
+#include "Islands.h"
 
 using std::list;
 
+//The properties of a sphere to be created by Verlet::CreateSpheres
+struct SphereDesc {
+	Vector3 position;
+	float radius;
+	float mass;
+	float drag;
+	float elasticity;
+};
+
 //This IS the physics engine, done using verlet integration
 class Verlet
 {
 public:
-	//Constructor for the physics engine
-	Verlet(Vector3, int threshold = 2, int maxDepth = 3);
+	//Constructor for the physics engine. The broad phase type chooses which
+	//octree implementation partitions the world. A looseness above 0 makes the
+	//pointer octree a loose octree (see Octree). The engine's work is shared between
+	//the supplied number of threads, or one per hardware thread if 0.
+	Verlet(Vector3, int threshold = 2, int maxDepth = 3, BroadPhaseType broadPhase = POINTER_OCTREE, float looseness = 0.0f, int threads = 0);
 	~Verlet(void);
 
-	//Takes in an Sphere and updates it, with a supplied time interval
-	static void update(Sphere& e, const float& time){
-		if (e.awake){
-			Vector3 tempPos = e.position;
-			e.position += ((e.position - e.lastPos) + e.accel * (time * time)) * e.drag;
-			e.lastPos = tempPos;
-
-			//Put this object to sleep if it is not moving.
-			if ((e.lastPos - e.position).absolute() < 0.00001f){
-				e.lastPos = e.position;
-				e.awake = false;
-				//The sphere turns brown if it is asleep!
-				e.ro->SetTexture(TextureManager::Instance().GetTexture("brown.png"));
-			}
-		}
-	}
-
 	//The method to be called every step to update the physics engine.
 	inline void update(const float& msec){
-		//Loop through list, updating objects
-		for (list<Sphere*>::const_iterator i = spheres.begin(); i != spheres.end(); ++i){
-			//Only update the awake objects
-			update(**i, msec);
-		}
+		//Integrate every awake sphere, 4 at a time, sharing groups of 4 out between
+		//the workers. The awake spheres' particles are kept together at the front of
+		//the store, so the sleeping spheres are never visited.
+		ThreadPool::Job integrate = [&](int begin, int end, int worker){
+			vector<int>& m = moved[worker];
+			m.clear();
 
-		//Update the octree
-		o->Update();
+			particles.Integrate(msec, begin * 4, end * 4, m);
+
+			//Every sphere that moved must be updated in the octree
+			for (unsigned int i=0; i<m.size(); ++i){
+				particles.GetOwner(m[i])->Changed();
+			}
+		};
+
+		workers->ParallelFor(particles.GetAwakeGroupCount(), integrate);
+
+		//Update the octree with the spheres that have changed. Spheres changed
+		//from here on are recorded for the next update.
+		o->Update(journal->Changed());
+		journal->Clear();
 
 		//Perform collision detection and resolution for sphere v sphere
 		o->ResolveCollisions(msec);
 
-		//Loop through the list and check for plane collisions.
-		//This currently checks every sphere with every plane. This is only a 6n = O(n) check.
-		//Not a huge deal, but given more time this check would be neatened.
-		for (list<Sphere*>::const_iterator i = spheres.begin(); i != spheres.end(); ++i){
-			//Check all awake spheres for plane collision
-			if ((*i)->getAwake()){
-
-				//Loop through the list of planes
-				for (list<Plane*>::const_iterator j = planes.begin(); j != planes.end(); ++j){
-					//Check if plane has collided with sphere
-					if ((*j)->Collided(**i)){
-						//If so resolve collision
-						(*j)->ResolveCollision(**i, msec);
-					}
+		//Boxes and meshes are added rarely, so their trees are only built when one has been added
+		if (!boxes.IsBuilt()){
+			boxes.Build();
+		}
+
+		if (!triangles.IsBuilt()){
+			triangles.Build();
+		}
+
+		//Check every awake sphere for collisions with the static geometry. These only change
+		//that sphere, so the spheres are shared out between the workers. Each sphere is only
+		//tested against the planes that cut the nodes it is in, and the boxes and triangles
+		//found by a descent of their trees.
+		bool masked = planes.GetCount() <= PlaneSet::MASK_BITS;
+
+		ThreadPool::Job collidePlanes = [&](int begin, int end, int worker){
+			for (int i = begin; i < end; ++i){
+				Sphere& s = *particles.GetOwner(i);
+				PlaneMask nearby = o->NearbyPlanes(s);
+
+				//Spheres away from the edges of the world are near no planes at all
+				if (nearby != 0 || !masked){
+					planes.Collide(s, nearby, msec);
 				}
+
+				boxes.Collide(s, msec);
+				triangles.Collide(s, msec);
 			}
-		}
+		};
+
+		//Only the awake spheres are checked. Resolving their collisions wakes spheres that
+		//are already awake, so no particle moves in the store while the workers run.
+		workers->ParallelFor(particles.GetAwakeCount(), collidePlanes);
+
+		//Every collision of the step has now been resolved, so each awake sphere's rest
+		//is measured by how far it has moved over the whole step. A sphere resting on
+		//something is pulled down by gravity and pushed back up, so ends where it began.
+		ThreadPool::Job measureRest = [&](int begin, int end, int worker){
+			particles.MeasureRest(msec, begin * 4, end * 4);
+		};
+
+		workers->ParallelFor(particles.GetAwakeGroupCount(), measureRest);
+
+		//Wake the islands that have been disturbed, and put to sleep those that have
+		//been at rest long enough. The sphere turns brown if it is asleep! The octree
+		//is told too, so it can skip the parts of the world that are asleep.
+		islands.Update(particles, o->GetContacts());
 	};
 
 	//Method that takes in a renderer and draws its contents.
@@ -79,10 +124,16 @@ public:
 		}
 
 		//Draw all of the planes
-		for (list<Plane*>::const_iterator i = planes.begin(); i != planes.end(); ++i){
-			(*i)->Draw(r);
+		for (int i=0; i<planes.GetCount(); ++i){
+			planes.Get(i)->Draw(r);
 		}
 
+		//Draw all of the boxes and meshes
+		for (int i=0; i<boxes.GetCount(); ++i){
+			boxes.Get(i)->Draw(r);
+		}
+		triangles.Draw(r);
+
 		//Draw all of the spheres as actual shapes again, using
 		//gl fill
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -94,7 +145,7 @@ public:
 	//Method for creating and inserting a sphere into the physics engine for updating.
 	Sphere* CreateSphere(const Vector3& position, const float& radius, const float& mass, const float& drag = 1.0f, const float& elasticity = 0.3f){
 		//Create the sphere
-		Sphere* s = new Sphere(position, radius, mass, drag, elasticity);
+		Sphere* s = new Sphere(particles, position, radius, mass, drag, elasticity);
 
 		//If the sphere was not successfully inserted, return false
 		if (!o->AddSphere(*s)){
@@ -105,15 +156,107 @@ public:
 
 		//Add the sphere to the sequential list.
 		spheres.push_back(s);
+		s->engineEntry = --spheres.end();
+
+		//From now on the sphere records its changes for the broad phase
+		s->journal = journal;
 
 		//Return a pointer to the newly created shape.
 		return s;
 	}
 
+	//Removes a sphere from the physics engine and deletes it. The sphere is taken
+	//straight out of the broad phase and the sequential list, without searching either.
+	inline void DestroySphere(Sphere* s){
+		//Whatever the sphere was resting against may now fall
+		islands.Wake(*s);
+
+		o->RemoveSphere(*s);
+		journal->Forget(*s);
+		spheres.erase(s->engineEntry);
+		delete s;
+	}
+
+	//Method for creating a batch of spheres at once, adding each sphere created to the
+	//supplied list. The broad phase is given the whole batch, so an empty octree can be
+	//built in one pass rather than a descent per sphere. Returns the number created.
+	int CreateSpheres(const vector<SphereDesc>& descs, vector<Sphere*>& created){
+		vector<Sphere*> batch;
+		batch.reserve(descs.size());
+
+		for (unsigned int i=0; i<descs.size(); ++i){
+			const SphereDesc& d = descs[i];
+			batch.push_back(new Sphere(particles, d.position, d.radius, d.mass, d.drag, d.elasticity));
+		}
+
+		int added = o->AddSpheres(batch);
+
+		//Any spheres the broad phase refused are at the end of the batch
+		for (unsigned int i=added; i<batch.size(); ++i){
+			std::cout << "FAILED TO INSERT:\n" << *batch[i] << std::endl;
+			delete batch[i];
+		}
+
+		for (int i=0; i<added; ++i){
+			Sphere* s = batch[i];
+
+			spheres.push_back(s);
+			s->engineEntry = --spheres.end();
+			s->journal = journal;
+
+			created.push_back(s);
+		}
+
+		return added;
+	}
+
+	//Sets the margin the broad phase grows spheres' bounds by, so that moving spheres
+	//only need updating in it once they escape them (see BroadPhase::SetMargin)
+	inline void SetBroadPhaseMargin(float velocityScale, float padding){
+		o->SetMargin(velocityScale, padding);
+	}
+
+	//Sets the number of times the contacts between spheres are solved each frame.
+	//More iterations make stacks of spheres steadier, at the cost of more work.
+	inline void SetSolverIterations(int iterations){
+		o->SetSolverIterations(iterations);
+	}
+
 	//Create a plane given supplied properties
 	inline void CreatePlane(const Vector3& plane, const float& distance, const Vector3& sizeForRender){
-		//Add to the list of stored planes
-		planes.push_back(new Plane(plane, distance, sizeForRender));
+		//Add to the set of stored planes
+		planes.Add(new Plane(plane, distance, sizeForRender));
+
+		//The broad phase works out which planes the spheres in each part of the world are near
+		o->SetPlanes(planes);
+	}
+
+	//Create a static box given its center and half its size along each axis. Thin
+	//boxes make finite slabs. Returns a pointer to the box, which the engine owns.
+	inline Box* CreateBox(const Vector3& position, const Vector3& halfSize){
+		Box* b = new Box(position, halfSize);
+
+		//The tree of boxes is built again at the next update
+		boxes.Add(b);
+
+		return b;
+	}
+
+	//Create a static collider from the triangles of a mesh, placed in the world by the
+	//supplied transform. The mesh is loaded with its triangles kept if it has not been.
+	//Returns false if the mesh has no triangles to collide with.
+	inline bool CreateMeshCollider(const string& mesh, const Matrix4& transform){
+		Mesh* m = MeshManager::Instance().AddMesh(mesh, true);
+
+		if (m == NULL || m->GetTriangles().empty()){
+			std::cout << "FAILED TO CREATE MESH COLLIDER: " << mesh << std::endl;
+			return false;
+		}
+
+		//The tree of triangles is built again at the next update
+		triangles.Add(m, transform);
+
+		return true;
 	}
 
 	//Apply gravity to all spheres in the engine.
@@ -129,14 +272,30 @@ public:
 			(*i)->setAcceleration(Vector3(0,0,0));
 		}
 	}
-	
+
+	//The number of spheres that are awake, and so are integrated every update
+	inline int GetAwakeCount() const { return particles.GetAwakeCount(); }
+
 protected:
 	//Protected constructor to prevent instantiation of class without using specified constructor.
 	Verlet(void);
 
 	//This octree contains a reference to all of the spheres in the simulation!
 	//We use this for geographical collision detection
-	Octree* o;
+	BroadPhase* o;
+
+	//The threads the engine shares its work out between
+	ThreadPool* workers;
+
+	//The position, velocity and acceleration of every sphere, stored for fast
+	//integration. Declared before the spheres, which release their particles.
+	ParticleStore particles;
+
+	//The particles each worker moved in the last integration
+	vector<vector<int>> moved;
+
+	//Puts spheres to sleep, and wakes them, an island of touching spheres at a time
+	Islands islands;
 
 	//This list contains a reference to all of the spheres in the engine
 	//We use this for sequential access (i.e updating all objects), 
@@ -144,9 +303,21 @@ protected:
 	//the octree
 	list<Sphere*> spheres;
 
-	//This list contains a reference to all of the planes in the engine
-	//to be tested against.
-	list<Plane*> planes;
+	//Every sphere that has moved or changed size since the octree was last updated.
+	//Created with a list for each worker.
+	SphereJournal* journal;
+
+	//This set contains all of the planes in the engine to be tested against,
+	//and deletes them with the engine
+	PlaneSet planes;
+
+	//The static boxes in the engine, in a tree built once they have been added.
+	//It is separate from the octree, so it is never updated as spheres move.
+	StaticTree boxes;
+
+	//The triangles of the static meshes in the engine, in a tree built once the
+	//meshes have been added
+	TriangleTree triangles;
 
 
 };